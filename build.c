@@ -0,0 +1,298 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+#include <ftw.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * The maximum number of file descriptors
+ * `nftw` may use when walking a directory.
+ */
+#ifndef WALK_FDS
+# define WALK_FDS  32
+#endif
+
+/**
+ * The exit status of a worker that found
+ * the index file to be up to date.
+ */
+#define EXIT_CURRENT  2
+
+
+
+/**
+ * A file to index.
+ */
+struct document {
+	/**
+	 * The pathname of the file.
+	 */
+	char *path;
+
+	/**
+	 * The size of the file.
+	 */
+	off_t size;
+};
+
+
+
+/**
+ * The files to index.
+ */
+static struct document *documents = NULL;
+
+/**
+ * The number of elements in `documents`.
+ */
+static size_t document_count = 0;
+
+/**
+ * The allocation size of `documents`.
+ */
+static size_t document_capacity = 0;
+
+/**
+ * The name of the program, for error messages.
+ */
+static const char *program;
+
+/**
+ * The status of the cache directory, which is not
+ * indexed, `st_ino` is 0 if there is none.
+ */
+static struct stat cache_st;
+
+/**
+ * The pathname of the directory being skipped,
+ * `NULL` if none.
+ */
+static char *skipped_path = NULL;
+
+/**
+ * The length of `skipped_path`.
+ */
+static size_t skipped_len;
+
+/**
+ * The number of paths that could not be indexed
+ * because they are symbolic links.
+ */
+static size_t links;
+
+
+
+/**
+ * Add a file found in a directory walk to the files to index.
+ * 
+ * @param   path  The pathname of the file.
+ * @param   st    The status of the file.
+ * @param   type  The type of file, as reported by `nftw`.
+ * @param   ftw   The depth of the file in the walk.
+ * @return        0 to continue the walk, -1 on error.
+ */
+static int
+add_document(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	void *new;
+
+	/* The contents of the cache directory are not documents. */
+	if (skipped_path && !strncmp(path, skipped_path, skipped_len) && path[skipped_len] == '/')
+		return 0;
+	if (type == FTW_D && cache_st.st_ino && st->st_dev == cache_st.st_dev && st->st_ino == cache_st.st_ino) {
+		free(skipped_path);
+		skipped_path = strdup(path);
+		if (!skipped_path)
+			return -1;
+		skipped_len = strlen(path);
+		return 0;
+	}
+
+	/* Symbolic links are not followed, but if one was
+	 * given as a path, the user should know that it
+	 * was not indexed. */
+	if ((type == FTW_SL || type == FTW_SLN) && !ftw->level) {
+		fprintf(stderr, "%s: %s: symbolic link not followed\n", program, path);
+		links++;
+		return 0;
+	}
+
+	if (type == FTW_DNR || type == FTW_NS) {
+		fprintf(stderr, "%s: %s: %s\n", program, path, strerror(errno ? errno : EACCES));
+		return 0;
+	}
+	if (type != FTW_F || !S_ISREG(st->st_mode) || is_index_file(path))
+		return 0;
+
+	if (document_count == document_capacity) {
+		document_capacity = document_capacity ? document_capacity << 1 : 64;
+		new = realloc(documents, document_capacity * sizeof(*documents));
+		if (!new)
+			return -1;
+		documents = new;
+	}
+	documents[document_count].path = strdup(path);
+	if (!documents[document_count].path)
+		return -1;
+	documents[document_count++].size = st->st_size;
+	return 0;
+}
+
+
+/**
+ * Compare two files for `qsort`, so
+ * that larger files are sorted first.
+ * 
+ * @param   a  One of the files.
+ * @param   b  The other file.
+ * @return     Negative if `a` is larger than `b`, positive
+ *             if `a` is smaller than `b`, 0 otherwise.
+ */
+static int
+compare_documents(const void *a, const void *b)
+{
+	off_t x = ((const struct document *)a)->size;
+	off_t y = ((const struct document *)b)->size;
+	return x > y ? -1 : x < y;
+}
+
+
+/**
+ * Index a file in a worker process.
+ * 
+ * @param   path  The pathname of the file.
+ * @return        The exit status for the worker.
+ */
+static int
+index_document(const char *path)
+{
+	int fd, r;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto fail;
+	r = build_index(fd);
+	if (r < 0)
+		goto fail;
+	close(fd);
+	return r ? EXIT_CURRENT : 0;
+
+fail:
+	fprintf(stderr, "%s: %s: %s\n", program, path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return 1;
+}
+
+
+/**
+ * Get the number of worker processes by reading the
+ * environment variable READ_QUICKLY_JOBS, which defaults
+ * to the number of online processors.
+ * 
+ * @return  The number of worker processes.
+ */
+static size_t
+get_jobs(void)
+{
+	const char *s = getenv("READ_QUICKLY_JOBS");
+	char *end;
+	long r;
+	if (s && isdigit(*s)) {
+		errno = 0;
+		r = strtol(s, &end, 10);
+		if (!errno && !*end && r > 0)
+			return (size_t)r;
+	}
+	r = sysconf(_SC_NPROCESSORS_ONLN);
+	return r > 0 ? (size_t)r : 1;
+}
+
+
+/**
+ * Build the index files for all regular files in
+ * directories, so that they open without being split.
+ * Files with up to date index files are skipped.
+ * 
+ * The files are indexed in parallel by worker processes,
+ * one file per worker, which are started as workers exit
+ * so that none is idle while files remain. The largest
+ * files are indexed first, so that the workers finish at
+ * about the same time.
+ * 
+ * @param   prog   The name of the program, for error messages.
+ * @param   paths  The directories, or files, to index.
+ * @param   n      The number of elements in `paths`.
+ * @return         0 on success, -1 if any file could not be
+ *                 indexed, or on error (which has been printed).
+ */
+int
+build_indexes(const char *prog, char *const *paths, size_t n)
+{
+	size_t i, next = 0, running = 0, jobs, built = 0, current = 0, failed = 0;
+	pid_t pid;
+	int status;
+
+	program = prog;
+	links = 0;
+	if (stat_index_cache(&cache_st))
+		cache_st.st_ino = 0;
+	for (i = 0; i < n; i++) {
+		errno = 0;
+		if (nftw(paths[i], add_document, WALK_FDS, FTW_PHYS)) {
+			fprintf(stderr, "%s: %s: %s\n", program, paths[i], strerror(errno ? errno : ENOMEM));
+			failed++;
+		}
+	}
+	free(skipped_path);
+	skipped_path = NULL;
+	failed += links;
+	qsort(documents, document_count, sizeof(*documents), compare_documents);
+
+	jobs = get_jobs();
+	fflush(stdout);
+	fflush(stderr);
+	while (next < document_count || running) {
+		while (next < document_count && running < jobs) {
+			pid = fork();
+			if (pid < 0) {
+				if (!running) {
+					fprintf(stderr, "%s: fork: %s\n", program, strerror(errno));
+					failed += document_count - next;
+					next = document_count;
+				}
+				break;
+			}
+			if (!pid)
+				_exit(index_document(documents[next].path));
+			next++;
+			running++;
+		}
+		if (!running)
+			break;
+		pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		running--;
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_CURRENT)
+			current++;
+		else if (WIFEXITED(status) && !WEXITSTATUS(status))
+			built++;
+		else
+			failed++;
+	}
+
+	trim_index_cache();
+	printf("%zu built, %zu up to date, %zu failed\n", built, current, failed);
+
+	while (document_count)
+		free(documents[--document_count].path);
+	free(documents);
+	documents = NULL;
+	document_capacity = 0;
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,635 @@
+/* See LICENSE file for copyright and license details. */
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+
+
+/**
+ * The maximum number of clients that can
+ * be attached to a server at the same time.
+ */
+#ifndef MAX_CLIENTS
+# define MAX_CLIENTS  64
+#endif
+
+/**
+ * The maximum number of connections to the
+ * control socket at the same time.
+ */
+#ifndef MAX_CONTROLLERS
+# define MAX_CONTROLLERS  8
+#endif
+
+
+
+/**
+ * The maximum number of bytes, in addition
+ * to the word, that the frame displaying
+ * a word is made of.
+ */
+#define FRAME_OVERHEAD  96
+
+/**
+ * The number of units word rates are expressed
+ * in per word per minute.
+ */
+#define RATE_SCALE  1000
+
+
+
+/**
+ * Commands, in addition to keys, that can be
+ * received over the control socket.
+ */
+enum {
+	/**
+	 * Go to the word with the index in the argument.
+	 */
+	KEY_SEEK = 0x100,
+
+	/**
+	 * Go forward, or backward if negative, the
+	 * number of words in the argument.
+	 */
+	KEY_SKIP
+};
+
+/**
+ * The unit a length of a rate schedule is measured in.
+ */
+enum schedule_unit {
+	/**
+	 * The number of displayed words.
+	 */
+	SCHEDULE_WORDS,
+
+	/**
+	 * The number of nanoseconds words have been displayed.
+	 */
+	SCHEDULE_NANOSECONDS
+};
+
+/**
+ * The shape of the warm-up ramp of a rate schedule.
+ */
+enum ramp_curve {
+	/**
+	 * The rate increases evenly.
+	 */
+	RAMP_LINEAR,
+
+	/**
+	 * The rate increases slowly at the beginning
+	 * and the end of the ramp, and fastest in
+	 * the middle of it.
+	 */
+	RAMP_SMOOTH
+};
+
+/**
+ * A schedule for the word rate, ramping up
+ * from a start rate to the selected rate.
+ */
+struct schedule {
+	/**
+	 * The rate at the start of the ramp, in words
+	 * per minute multiplied by `RATE_SCALE`.
+	 */
+	long start_rate;
+
+	/**
+	 * The length of the ramp, in `length_unit`.
+	 */
+	long long length;
+
+	/**
+	 * The unit of `length`.
+	 */
+	enum schedule_unit length_unit;
+
+	/**
+	 * The shape of the ramp.
+	 */
+	enum ramp_curve curve;
+
+	/**
+	 * The interval, in `period_unit`, at which the ramp
+	 * starts over, making the rate a sawtooth wave,
+	 * 0 if the ramp is only run once.
+	 */
+	long long period;
+
+	/**
+	 * The unit of `period`.
+	 */
+	enum schedule_unit period_unit;
+};
+
+/**
+ * Real-time facilities that `setup_realtime` can set up.
+ */
+enum realtime_grant {
+	/**
+	 * The process has the SCHED_FIFO scheduling policy.
+	 */
+	REALTIME_FIFO = 0x01,
+
+	/**
+	 * The process has the SCHED_RR scheduling policy.
+	 */
+	REALTIME_RR = 0x02,
+
+	/**
+	 * The process's timer slack has been minimised.
+	 */
+	REALTIME_TIMERSLACK = 0x04,
+
+	/**
+	 * The process's memory has been locked.
+	 */
+	REALTIME_LOCKED = 0x08,
+
+	/**
+	 * The process has been pinned to a CPU.
+	 */
+	REALTIME_PINNED = 0x10
+};
+
+/**
+ * Paces lines by their timestamps.
+ */
+struct replay {
+	/**
+	 * The time between two lines is the difference between
+	 * their timestamps divided by this, multiplied by `RATE_SCALE`.
+	 */
+	long factor;
+
+	/**
+	 * The longest time between two lines,
+	 * in the unit in `max_gap_unit`.
+	 */
+	long long max_gap;
+
+	/**
+	 * The unit of `max_gap`.
+	 */
+	enum schedule_unit max_gap_unit;
+};
+
+/**
+ * Keeps track of the time to display each word.
+ */
+struct pacer {
+	/**
+	 * The selected number of words per minute,
+	 * multiplied by `RATE_SCALE`.
+	 */
+	long rate;
+
+	/**
+	 * The number of words per minute, multiplied by
+	 * `RATE_SCALE`, the last word was displayed at;
+	 * differs from `rate` during the ramp of `schedule`.
+	 */
+	long current_rate;
+
+	/**
+	 * The rounding error carried over from
+	 * the previous interval, in units of
+	 * 1 / `current_rate` nanoseconds.
+	 */
+	long long remainder;
+
+	/**
+	 * The rate schedule, `NULL` for a constant rate.
+	 */
+	const struct schedule *schedule;
+
+	/**
+	 * The number of intervals that have been handed out.
+	 */
+	long long words;
+
+	/**
+	 * The sum of the intervals that have been
+	 * handed out, in nanoseconds.
+	 */
+	long long elapsed;
+
+	/**
+	 * The value of `words` when the ramp last started.
+	 */
+	long long ramp_words;
+
+	/**
+	 * The value of `elapsed` when the ramp last started.
+	 */
+	long long ramp_elapsed;
+
+	/**
+	 * The pacing of lines by their timestamps,
+	 * `NULL` if lines are not paced.
+	 */
+	const struct replay *replay;
+
+	/**
+	 * Whether `line_time` and `line_deadline` are set;
+	 * cleared when the pacing is interrupted, such as
+	 * when the reader pauses or goes to another word.
+	 */
+	int have_line;
+
+	/**
+	 * The timestamp of the last line with a timestamp,
+	 * in nanoseconds since an arbitrary point in time.
+	 */
+	long long line_time;
+
+	/**
+	 * The time, in nanoseconds, the last
+	 * line with a timestamp was displayed at.
+	 */
+	long long line_deadline;
+};
+
+/**
+ * Adjusts the word rate to the reader's behaviour.
+ */
+struct adapter {
+	/**
+	 * The lowest rate the adapter may slow down to,
+	 * in words per minute multiplied by `RATE_SCALE`.
+	 */
+	long min_rate;
+
+	/**
+	 * The highest rate the adapter may speed up to,
+	 * in words per minute multiplied by `RATE_SCALE`.
+	 */
+	long max_rate;
+
+	/**
+	 * The recent interventions by the reader, each
+	 * counted as `ADAPT_UNIT` and decaying as words
+	 * are displayed.
+	 */
+	long long load;
+};
+
+/**
+ * Kinds of interventions by the reader.
+ */
+enum intervention {
+	/**
+	 * The reader went back to a previous word.
+	 */
+	INTERVENTION_REWIND,
+
+	/**
+	 * The reader paused.
+	 */
+	INTERVENTION_PAUSE
+};
+
+/**
+ * A listening Unix socket and the connections
+ * to it, see `start_listener`.
+ */
+struct listener {
+	/**
+	 * The listening socket, -1 if none.
+	 */
+	int fd;
+
+	/**
+	 * The pathname of the listening socket.
+	 */
+	const char *path;
+
+	/**
+	 * The connections, each of which begins
+	 * with an `int`: its socket.
+	 */
+	void *connections;
+
+	/**
+	 * The size of each element in `connections`.
+	 */
+	size_t connection_size;
+
+	/**
+	 * The number of connections.
+	 */
+	size_t count;
+
+	/**
+	 * The number of elements `connections` has room for.
+	 */
+	size_t max_connections;
+
+	/**
+	 * Function that frees the resources of a connection,
+	 * other than its socket, when it is closed, may be `NULL`.
+	 * 
+	 * @param  connection  The connection.
+	 */
+	void (*release)(void *connection);
+};
+
+/**
+ * A cell in a model of a terminal's screen.
+ */
+struct vt_cell {
+	/**
+	 * The character, 0 if the cell is covered
+	 * by a wide character to the left.
+	 */
+	uint32_t c;
+
+	/**
+	 * The graphic rendition attributes.
+	 */
+	uint32_t attributes;
+
+	/**
+	 * The foreground colour, -1 for the default.
+	 */
+	int32_t fg;
+
+	/**
+	 * The background colour, -1 for the default.
+	 */
+	int32_t bg;
+};
+
+/**
+ * A model of a terminal, see `vt_init`.
+ */
+struct vt {
+	/**
+	 * The width of the screen.
+	 */
+	size_t width;
+
+	/**
+	 * The height of the screen.
+	 */
+	size_t height;
+
+	/**
+	 * The row of the cursor, 0 for the top row.
+	 */
+	size_t row;
+
+	/**
+	 * The column of the cursor, 0 for the leftmost column.
+	 */
+	size_t col;
+
+	/**
+	 * Whether the cursor is past the right margin,
+	 * so that the next character wraps.
+	 */
+	int wrap;
+
+	/**
+	 * The current graphic rendition, as a cell.
+	 */
+	struct vt_cell pen;
+
+	/**
+	 * The state of the parser.
+	 */
+	int state;
+
+	/**
+	 * The parameter bytes of the control sequence being parsed.
+	 */
+	char params[64];
+
+	/**
+	 * The number of bytes in `params`.
+	 */
+	size_t param_len;
+
+	/**
+	 * The bits of the UTF-8 sequence being decoded.
+	 */
+	uint32_t utf8;
+
+	/**
+	 * The number of bytes left in the
+	 * UTF-8 sequence being decoded.
+	 */
+	int utf8_pending;
+
+	/**
+	 * The cells of the screen, row by row.
+	 */
+	struct vt_cell *cells;
+
+	/**
+	 * The number of bytes written.
+	 */
+	size_t bytes;
+
+	/**
+	 * The number of control functions written.
+	 */
+	size_t controls;
+
+	/**
+	 * The number of control functions written
+	 * that are not modelled.
+	 */
+	size_t unsupported;
+};
+
+/**
+ * Flags that can be set in `word_flags`.
+ */
+enum word_flag {
+	/**
+	 * Should reverse video be applied?
+	 */
+	WORD_REVERSE_VIDEO = 0x01,
+
+	/**
+	 * Can the word be skipped when skimming?
+	 */
+	WORD_SKIMMABLE = 0x02,
+
+	/**
+	 * Is the word the first word on its line?
+	 */
+	WORD_LINE_START = 0x04,
+
+	/**
+	 * Does the word contain a keyword in the watchlist?
+	 */
+	WORD_WATCHED = 0x08,
+
+	/**
+	 * Was the word inserted in the new version
+	 * of a document?
+	 */
+	WORD_INSERTED = 0x10,
+
+	/**
+	 * Was the word deleted from the old version
+	 * of a document?
+	 */
+	WORD_DELETED = 0x20
+};
+
+
+
+/* read-quickly.c */
+extern size_t word_count;
+extern size_t word_capacity;
+extern char *text;
+extern size_t text_size;
+extern size_t *word_offsets;
+extern uint16_t *word_widths;
+extern uint8_t *word_anchors;
+extern uint8_t *word_flags;
+int split_words(void);
+int load_file(int fd);
+void free_words(void);
+int format_word(char *buf, size_t size, size_t i, size_t width, size_t height);
+
+/* frame.c */
+int encode_frame(char *buf, size_t size, size_t i, size_t width, size_t height, size_t repeats);
+void invalidate_frames(void);
+
+/* index.c */
+int load_indexed_file(int fd, int create);
+int build_index(int fd);
+void trim_index_cache(void);
+int stat_index_cache(struct stat *st);
+int is_index_file(const char *path);
+size_t index_size(void);
+int release_index(void);
+
+/* build.c */
+int build_indexes(const char *prog, char *const *paths, size_t n);
+
+/* diff.c */
+int load_diff(int old_fd, int new_fd);
+
+/* export.c */
+int is_export_format(const char *format);
+int export_words(const char *format, long rate, const struct schedule *schedule,
+                 const struct replay *replay, int realtime);
+
+/* pace.c */
+void pacer_init(struct pacer *pacer, long rate, const struct schedule *schedule);
+void pacer_set_rate(struct pacer *pacer, long rate);
+long long pacer_next(struct pacer *pacer);
+void pacer_replay(struct pacer *pacer, const struct replay *replay);
+long long pacer_line(struct pacer *pacer, size_t i, long long t);
+void adapter_init(struct adapter *adapter, long min_rate, long max_rate);
+long adapter_intervene(struct adapter *adapter, enum intervention what, long rate);
+long adapter_advance(struct adapter *adapter, long rate);
+
+/* lines.c */
+int collapse_lines(int mask_digits);
+void free_line_runs(void);
+int line_hidden(size_t i, size_t *firstp, size_t *endp);
+size_t line_repeats(size_t i);
+int expand_lines(size_t i);
+
+/* watch.c */
+int load_watchlist(const char *path);
+void free_watchlist(void);
+void mark_watched_words(size_t first, size_t end);
+
+/* filter.c */
+int add_line_filter(const char *regex, int exclude);
+void free_line_filters(void);
+int filter_lines(void);
+
+/* fields.c */
+int add_fields(const char *spec);
+void free_fields(void);
+int extract_fields(void);
+
+/* memory.c */
+void advise_huge_pages(void *ptr, size_t size);
+void *realloc_large(void *ptr, size_t old_size, size_t size);
+void report_memory(const char *prog);
+
+/* vt.c */
+int vt_init(struct vt *vt, size_t width, size_t height);
+void vt_destroy(struct vt *vt);
+void vt_write(struct vt *vt, const char *s, size_t n);
+int vt_differs(const struct vt *a, const struct vt *b, size_t *rowp, size_t *colp);
+
+/* replay.c */
+int load_timestamps(void);
+void free_timestamps(void);
+int line_timestamp(size_t i, long long *tp);
+
+/* realtime.c */
+int setup_realtime(long cpu);
+void start_jitter_measurement(void);
+void record_lateness(long long lateness);
+void report_jitter(const char *prog);
+
+/* listener.c */
+int start_listener(struct listener *l, const char *path);
+void drop_connection(struct listener *l, size_t i);
+void stop_listener(struct listener *l);
+size_t listener_poll_fds(struct listener *l, struct pollfd *fds);
+size_t accept_connections(struct listener *l, const struct pollfd *fds);
+
+/* server.c */
+int start_server(const char *path);
+void stop_server(void);
+void broadcast_word(size_t i);
+size_t server_poll_fds(struct pollfd *fds);
+void server_handle_fds(const struct pollfd *fds, size_t n);
+
+/* control.c */
+int start_control(const char *path);
+void stop_control(void);
+size_t control_poll_fds(struct pollfd *fds);
+void control_handle_fds(const struct pollfd *fds, size_t n);
+int next_command(int *keyp, long *argp);
+
+
+
+/**
+ * Get a word.
+ * 
+ * @param   i  The index of the word.
+ * @return     The word.
+ */
+static inline const char *
+get_word(size_t i)
+{
+	return &text[word_offsets[i]];
+}
+
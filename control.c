@@ -0,0 +1,259 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The maximum length of a command line.
+ */
+#define MAX_COMMAND_LINE  64
+
+/**
+ * The maximum number of received commands
+ * that have not yet been processed.
+ */
+#define MAX_QUEUED_COMMANDS  64
+
+
+
+/**
+ * A connection to the control socket.
+ */
+struct controller {
+	/**
+	 * The connected socket.
+	 */
+	int fd;
+
+	/**
+	 * The received part of the current command line.
+	 */
+	char buf[MAX_COMMAND_LINE];
+
+	/**
+	 * The number of bytes in `buf`.
+	 */
+	size_t len;
+};
+
+/**
+ * A received command.
+ */
+struct command {
+	/**
+	 * The key the command corresponds to,
+	 * or a `KEY_*` constant.
+	 */
+	int key;
+
+	/**
+	 * The argument of the command.
+	 */
+	long arg;
+};
+
+
+
+/**
+ * The connections to the control socket.
+ */
+static struct controller controllers[MAX_CONTROLLERS];
+
+/**
+ * The listening control socket, and the connections to it.
+ */
+static struct listener control = {
+	.fd = -1,
+	.connections = controllers,
+	.connection_size = sizeof(*controllers),
+	.max_connections = MAX_CONTROLLERS,
+	.release = NULL
+};
+
+/**
+ * Queue of received commands.
+ */
+static struct command commands[MAX_QUEUED_COMMANDS];
+
+/**
+ * The index of the first command in `commands`.
+ */
+static size_t command_head = 0;
+
+/**
+ * The number of commands in `commands`.
+ */
+static size_t command_count = 0;
+
+
+
+/**
+ * Create the control socket.
+ * 
+ * @param   path  The pathname of the socket to create.
+ * @return        0 on success, -1 on error.
+ */
+int
+start_control(const char *path)
+{
+	return start_listener(&control, path);
+}
+
+
+/**
+ * Close the control socket and all connections to it.
+ */
+void
+stop_control(void)
+{
+	stop_listener(&control);
+}
+
+
+/**
+ * Parse a command line and queue the command.
+ * 
+ * @param  line  The command line, without the line feed.
+ */
+static void
+parse_command(char *line)
+{
+	struct command cmd;
+	char *end;
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+	end = strchr(line, '\0');
+	while (end != line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		*--end = '\0';
+
+	cmd.arg = 0;
+	if (!strcmp(line, "+") || !strcmp(line, "faster")) {
+		cmd.key = '+';
+	} else if (!strcmp(line, "-") || !strcmp(line, "slower")) {
+		cmd.key = '-';
+	} else if (!strcmp(line, "p") || !strcmp(line, "pause")) {
+		cmd.key = 'p';
+	} else if (!strcmp(line, "q") || !strcmp(line, "quit")) {
+		cmd.key = 'q';
+	} else if (!strcmp(line, "e") || !strcmp(line, "expand")) {
+		cmd.key = 'e';
+	} else if (!strcmp(line, "prev")) {
+		cmd.key = 'D';
+	} else if (!strcmp(line, "next")) {
+		cmd.key = 'C';
+	} else if (!strcmp(line, "prevline")) {
+		cmd.key = '[';
+	} else if (!strcmp(line, "nextline")) {
+		cmd.key = ']';
+	} else if (!strncmp(line, "seek ", 5)) {
+		line += 5;
+		while (*line == ' ')
+			line++;
+		cmd.key = (*line == '+' || *line == '-') ? KEY_SKIP : KEY_SEEK;
+		if (!isdigit(line[*line == '+' || *line == '-']))
+			return;
+		errno = 0;
+		cmd.arg = strtol(line, &end, 10);
+		if (errno || *end)
+			return;
+	} else {
+		return;
+	}
+
+	if (command_count == MAX_QUEUED_COMMANDS)
+		return;
+	commands[(command_head + command_count++) % MAX_QUEUED_COMMANDS] = cmd;
+}
+
+
+/**
+ * Read commands from a connection to the control socket.
+ * 
+ * @param   c  The connection.
+ * @return     0 on success, -1 if the connection shall be closed.
+ */
+static int
+receive_commands(struct controller *c)
+{
+	char *line, *end;
+	ssize_t n;
+
+	n = recv(c->fd, &c->buf[c->len], sizeof(c->buf) - c->len, 0);
+	if (n <= 0)
+		return (n < 0 && (errno == EINTR || errno == EAGAIN)) ? 0 : -1;
+	c->len += (size_t)n;
+
+	for (line = c->buf; (end = memchr(line, '\n', c->len - (size_t)(line - c->buf))); line = &end[1]) {
+		*end = '\0';
+		parse_command(line);
+	}
+	c->len -= (size_t)(line - c->buf);
+	memmove(c->buf, line, c->len);
+
+	/* Discard overlong lines. */
+	if (c->len == sizeof(c->buf))
+		c->len = 0;
+	return 0;
+}
+
+
+/**
+ * Add the file descriptors of the control socket and
+ * its connections to a set of file descriptors to poll.
+ * 
+ * @param   fds  Output parameter for the file descriptors,
+ *               must have room for `MAX_CONTROLLERS + 1` elements.
+ * @return       The number of added file descriptors.
+ */
+size_t
+control_poll_fds(struct pollfd *fds)
+{
+	return listener_poll_fds(&control, fds);
+}
+
+
+/**
+ * Handle the events on the file descriptors
+ * added by `control_poll_fds`.
+ * 
+ * @param  fds  The polled file descriptors, as
+ *              added by `control_poll_fds`.
+ * @param  n    The return value of `control_poll_fds`.
+ */
+void
+control_handle_fds(const struct pollfd *fds, size_t n)
+{
+	size_t i;
+
+	if (!n)
+		return;
+
+	for (i = n - 1; i; i--)
+		if (fds[i].revents && receive_commands(&controllers[i - 1]))
+			drop_connection(&control, i - 1);
+
+	accept_connections(&control, fds);
+}
+
+
+/**
+ * Get the next received command.
+ * 
+ * @param   keyp  Output parameter for the key the command
+ *                corresponds to, or a `KEY_*` constant.
+ * @param   argp  Output parameter for the command's argument.
+ * @return        1 if a command was dequeued, 0 if there are
+ *                no received commands.
+ */
+int
+next_command(int *keyp, long *argp)
+{
+	if (!command_count)
+		return 0;
+	*keyp = commands[command_head].key;
+	*argp = commands[command_head].arg;
+	command_head = (command_head + 1) % MAX_QUEUED_COMMANDS;
+	command_count--;
+	return 1;
+}
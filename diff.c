@@ -0,0 +1,683 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The number of unchanged words displayed
+ * before and after each change.
+ */
+#ifndef DIFF_CONTEXT
+# define DIFF_CONTEXT  4
+#endif
+
+/**
+ * The word displayed where unchanged words are left out.
+ */
+#define DIFF_ELLIPSIS  "\xe2\x80\xa6"
+
+/**
+ * The least number of edits the search for the
+ * difference may try before it settles for a
+ * difference that is not necessarily minimal.
+ */
+#ifndef DIFF_MIN_COST_LIMIT
+# define DIFF_MIN_COST_LIMIT  256
+#endif
+
+
+
+/**
+ * A version of a document.
+ */
+struct version {
+	/**
+	 * The text the words are stored in.
+	 */
+	char *text;
+
+	/**
+	 * The offsets of the words in `text`.
+	 */
+	size_t *offsets;
+
+	/**
+	 * The non-empty words.
+	 */
+	const char **words;
+
+	/**
+	 * The interned identity of each word in `words`.
+	 */
+	uint32_t *ids;
+
+	/**
+	 * Whether each word in `words` is
+	 * present in the other version.
+	 */
+	uint8_t *matched;
+
+	/**
+	 * The identities of the words that also occur somewhere
+	 * in the other version; the other words cannot be matched
+	 * and are left out of the search for the difference.
+	 */
+	uint32_t *candidates;
+
+	/**
+	 * The index in `words` of each word in `candidates`.
+	 */
+	size_t *candidate_words;
+
+	/**
+	 * The number of elements in `words`.
+	 */
+	size_t count;
+
+	/**
+	 * The number of elements in `candidates`.
+	 */
+	size_t candidate_count;
+};
+
+/**
+ * Kinds of steps in a difference.
+ */
+enum step_kind {
+	/**
+	 * The word is in both versions.
+	 */
+	STEP_KEEP,
+
+	/**
+	 * The word is only in the old version.
+	 */
+	STEP_DELETE,
+
+	/**
+	 * The word is only in the new version.
+	 */
+	STEP_INSERT
+};
+
+/**
+ * A step in a difference.
+ */
+struct step {
+	/**
+	 * The index of the word, in the new version
+	 * unless `kind` is `STEP_DELETE`.
+	 */
+	size_t word;
+
+	/**
+	 * The number of unchanged words between this
+	 * word and the nearest change.
+	 */
+	size_t distance;
+
+	/**
+	 * The kind of step.
+	 */
+	enum step_kind kind;
+};
+
+
+
+/**
+ * The old version of the document.
+ */
+static struct version old_version;
+
+/**
+ * The new version of the document.
+ */
+static struct version new_version;
+
+/**
+ * The furthest reaching paths of the forward search,
+ * indexed by diagonal, in `bisect`.
+ */
+static long *forward_v = NULL;
+
+/**
+ * The furthest reaching paths of the backward search,
+ * indexed by diagonal, in `bisect`.
+ */
+static long *backward_v = NULL;
+
+/**
+ * The number of edits after which `bisect`
+ * gives up on finding the shortest edit script.
+ */
+static long cost_limit;
+
+
+
+/**
+ * Take over the loaded words, leaving no words loaded.
+ * 
+ * @param  v  Output parameter for the version.
+ */
+static void
+take_words(struct version *v)
+{
+	v->text = text;
+	v->offsets = word_offsets;
+	v->count = word_count;
+	text = NULL;
+	word_offsets = NULL;
+	free_words();
+}
+
+
+/**
+ * Deallocate a version.
+ * 
+ * @param  v  The version.
+ */
+static void
+free_version(struct version *v)
+{
+	free(v->text);
+	free(v->offsets);
+	free(v->words);
+	free(v->ids);
+	free(v->matched);
+	free(v->candidates);
+	free(v->candidate_words);
+	memset(v, 0, sizeof(*v));
+}
+
+
+/**
+ * Hash a word.
+ * 
+ * @param   s  The word.
+ * @return     The hash of the word.
+ */
+static uint64_t
+hash_word(const char *s)
+{
+	uint64_t h = UINT64_C(14695981039346656037);
+	for (; *s; s++)
+		h = (h ^ (uint64_t)(unsigned char)*s) * UINT64_C(1099511628211);
+	return h;
+}
+
+
+/**
+ * Give each distinct word in both versions a number,
+ * so that words can be compared by their numbers.
+ * 
+ * @param   countp  Output parameter for the number of distinct words.
+ * @return          0 on success, -1 on error.
+ */
+static int
+intern_words(uint32_t *countp)
+{
+	struct version *versions[] = {&old_version, &new_version}, *v;
+	const char **table;
+	uint32_t *table_ids, count = 0;
+	size_t size = 16, mask, i, j, k;
+
+	while (size < 2 * (old_version.count + new_version.count))
+		size <<= 1;
+	mask = size - 1;
+	table = calloc(size, sizeof(*table));
+	table_ids = malloc(size * sizeof(*table_ids));
+	if (!table || !table_ids)
+		goto fail;
+
+	for (k = 0; k < 2; k++) {
+		v = versions[k];
+		v->ids = malloc((v->count ? v->count : 1) * sizeof(*v->ids));
+		if (!v->ids)
+			goto fail;
+		for (i = 0; i < v->count; i++) {
+			j = (size_t)hash_word(v->words[i]) & mask;
+			while (table[j] && strcmp(table[j], v->words[i]))
+				j = (j + 1) & mask;
+			if (!table[j]) {
+				if (count == UINT32_MAX) {
+					errno = ENOMEM;
+					goto fail;
+				}
+				table[j] = v->words[i];
+				table_ids[j] = count++;
+			}
+			v->ids[i] = table_ids[j];
+		}
+	}
+
+	free(table);
+	free(table_ids);
+	*countp = count;
+	return 0;
+
+fail:
+	free(table);
+	free(table_ids);
+	return -1;
+}
+
+
+/**
+ * Prepare a version for the search for the difference.
+ * 
+ * @param   v          The version.
+ * @param   present    Whether each distinct word is
+ *                     present in the other version.
+ * @return             0 on success, -1 on error.
+ */
+static int
+prepare_version(struct version *v, const uint8_t *present)
+{
+	size_t i, n = v->count ? v->count : 1;
+
+	v->matched = calloc(n, sizeof(*v->matched));
+	v->candidates = malloc(n * sizeof(*v->candidates));
+	v->candidate_words = malloc(n * sizeof(*v->candidate_words));
+	if (!v->matched || !v->candidates || !v->candidate_words)
+		return -1;
+
+	v->candidate_count = 0;
+	for (i = 0; i < v->count; i++) {
+		if (present[v->ids[i]]) {
+			v->candidates[v->candidate_count] = v->ids[i];
+			v->candidate_words[v->candidate_count++] = i;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Mark a pair of candidate words as matched.
+ * 
+ * @param  i  The index of the candidate in the old version.
+ * @param  j  The index of the candidate in the new version.
+ */
+static void
+match(size_t i, size_t j)
+{
+	old_version.matched[old_version.candidate_words[i]] = 1;
+	new_version.matched[new_version.candidate_words[j]] = 1;
+}
+
+
+/**
+ * Find the middle of a shortest edit script (Myers' algorithm,
+ * searching from both ends at once so that only linear space
+ * is needed).
+ * 
+ * The time taken grows with the number of edits, so if the
+ * script needs more than `cost_limit` edits, the search stops
+ * and the versions are split where either search has come
+ * the furthest instead; the script is then only minimal
+ * up to that limit.
+ * 
+ * @param   a   The words in the old version.
+ * @param   n   The number of elements in `a`.
+ * @param   b   The words in the new version.
+ * @param   m   The number of elements in `b`.
+ * @param   xp  Output parameter for the position in `a`.
+ * @param   yp  Output parameter for the position in `b`.
+ * @return      1 if a place to split the versions was
+ *              found, 0 if `a` and `b` have no words
+ *              in common.
+ */
+static int
+bisect(const uint32_t *a, long n, const uint32_t *b, long m, long *xp, long *yp)
+{
+	long max_d = (n + m + 1) / 2, offset = max_d, length = 2 * max_d + 2;
+	long delta = n - m, d, k, x1, y1, x2, y2, k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0, best;
+	int front = (int)(delta & 1);
+
+	for (k = 0; k < length; k++)
+		forward_v[k] = backward_v[k] = -1;
+	forward_v[offset + 1] = 0;
+	backward_v[offset + 1] = 0;
+
+	for (d = 0; d < max_d; d++) {
+		for (k = -d + k1_start; k <= d - k1_end; k += 2) {
+			if (k == -d || (k != d && forward_v[offset + k - 1] < forward_v[offset + k + 1]))
+				x1 = forward_v[offset + k + 1];
+			else
+				x1 = forward_v[offset + k - 1] + 1;
+			y1 = x1 - k;
+			while (x1 < n && y1 < m && a[x1] == b[y1])
+				x1++, y1++;
+			forward_v[offset + k] = x1;
+			if (x1 > n) {
+				k1_end += 2;
+			} else if (y1 > m) {
+				k1_start += 2;
+			} else if (front && offset + delta - k >= 0 && offset + delta - k < length &&
+			           backward_v[offset + delta - k] != -1) {
+				if (x1 >= n - backward_v[offset + delta - k]) {
+					*xp = x1;
+					*yp = y1;
+					return 1;
+				}
+			}
+		}
+
+		for (k = -d + k2_start; k <= d - k2_end; k += 2) {
+			if (k == -d || (k != d && backward_v[offset + k - 1] < backward_v[offset + k + 1]))
+				x2 = backward_v[offset + k + 1];
+			else
+				x2 = backward_v[offset + k - 1] + 1;
+			y2 = x2 - k;
+			while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1])
+				x2++, y2++;
+			backward_v[offset + k] = x2;
+			if (x2 > n) {
+				k2_end += 2;
+			} else if (y2 > m) {
+				k2_start += 2;
+			} else if (!front && offset + delta - k >= 0 && offset + delta - k < length &&
+			           forward_v[offset + delta - k] != -1) {
+				x1 = forward_v[offset + delta - k];
+				y1 = x1 - (delta - k);
+				if (x1 >= n - x2) {
+					*xp = x1;
+					*yp = y1;
+					return 1;
+				}
+			}
+		}
+
+		if (d < cost_limit)
+			continue;
+		best = 0;
+		for (k = -d + k1_start; k <= d - k1_end; k += 2) {
+			x1 = forward_v[offset + k];
+			y1 = x1 - k;
+			if (x1 <= n && y1 <= m && x1 + y1 > best && x1 + y1 < n + m) {
+				best = x1 + y1;
+				*xp = x1;
+				*yp = y1;
+			}
+		}
+		for (k = -d + k2_start; k <= d - k2_end; k += 2) {
+			x2 = backward_v[offset + k];
+			y2 = x2 - k;
+			if (x2 <= n && y2 <= m && x2 + y2 > best && x2 + y2 < n + m) {
+				best = x2 + y2;
+				*xp = n - x2;
+				*yp = m - y2;
+			}
+		}
+		if (best)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find the longest common subsequence of two
+ * ranges of candidate words, and mark its words
+ * as matched. If the ranges differ too much,
+ * a common subsequence that is not necessarily
+ * the longest is settled for, see `bisect`.
+ * 
+ * @param  a      The candidate words in the old version.
+ * @param  n      The number of elements in `a`.
+ * @param  b      The candidate words in the new version.
+ * @param  m      The number of elements in `b`.
+ * @param  a_off  The index of `*a` among the old version's candidates.
+ * @param  b_off  The index of `*b` among the new version's candidates.
+ */
+static void
+diff_range(const uint32_t *a, size_t n, const uint32_t *b, size_t m, size_t a_off, size_t b_off)
+{
+	long x, y;
+
+	for (; n && m && *a == *b; n--, m--)
+		match(a_off++, b_off++), a++, b++;
+	for (; n && m && a[n - 1] == b[m - 1]; n--, m--)
+		match(a_off + n - 1, b_off + m - 1);
+	if (!n || !m)
+		return;
+
+	if (!bisect(a, (long)n, b, (long)m, &x, &y))
+		return;
+	diff_range(a, (size_t)x, b, (size_t)y, a_off, b_off);
+	diff_range(&a[x], n - (size_t)x, &b[y], m - (size_t)y, a_off + (size_t)x, b_off + (size_t)y);
+}
+
+
+/**
+ * Get the steps from the old version to the new version.
+ * 
+ * @param   countp  Output parameter for the number of steps.
+ * @return          The steps, `NULL` on error.
+ */
+static struct step *
+get_steps(size_t *countp)
+{
+	struct step *steps;
+	size_t i = 0, j = 0, n = 0, distance;
+
+	steps = malloc((old_version.count + new_version.count + 1) * sizeof(*steps));
+	if (!steps)
+		return NULL;
+
+	while (i < old_version.count || j < new_version.count) {
+		if (i < old_version.count && !old_version.matched[i]) {
+			steps[n].kind = STEP_DELETE;
+			steps[n++].word = i++;
+		} else if (j < new_version.count && !new_version.matched[j]) {
+			steps[n].kind = STEP_INSERT;
+			steps[n++].word = j++;
+		} else {
+			steps[n].kind = STEP_KEEP;
+			steps[n++].word = j++;
+			i++;
+		}
+	}
+
+	/* Measure the distance to the nearest change,
+	 * first backwards, then forwards. */
+	for (distance = SIZE_MAX, i = 0; i < n; i++) {
+		distance = steps[i].kind != STEP_KEEP ? 0 : distance == SIZE_MAX ? SIZE_MAX : distance + 1;
+		steps[i].distance = distance;
+	}
+	for (distance = SIZE_MAX, i = n; i--;) {
+		distance = steps[i].kind != STEP_KEEP ? 0 : distance == SIZE_MAX ? SIZE_MAX : distance + 1;
+		if (distance < steps[i].distance)
+			steps[i].distance = distance;
+	}
+
+	*countp = n;
+	return steps;
+}
+
+
+/**
+ * Replace the loaded words with the changed words
+ * and the unchanged words around them.
+ * 
+ * @param   steps  The steps from the old version to the new version.
+ * @param   n      The number of elements in `steps`.
+ * @return         0 on success, -1 on error.
+ */
+static int
+load_changes(const struct step *steps, size_t n)
+{
+	uint8_t *flags = NULL;
+	size_t i, size = 2, len = 0, count = 0;
+	const char *word;
+	int skipped = 0;
+	char *p;
+
+	/* Measure the text. */
+	for (i = 0; i < n; i++) {
+		if (steps[i].distance > DIFF_CONTEXT) {
+			skipped = 1;
+			continue;
+		}
+		if (skipped)
+			size += sizeof(DIFF_ELLIPSIS), count++;
+		skipped = 0;
+		word = steps[i].kind == STEP_DELETE ? old_version.words[steps[i].word] : new_version.words[steps[i].word];
+		size += strlen(word) + 1;
+		count++;
+	}
+
+	text = malloc(size);
+	flags = malloc(count ? count : 1);
+	if (!text || !flags)
+		goto fail;
+
+	/* Write the text, starting a new line after each left out
+	 * stretch of unchanged words, and remember the kind of change
+	 * of each word so that it can be marked once it is split. */
+	skipped = 0;
+	count = 0;
+	for (i = 0; i < n; i++) {
+		if (steps[i].distance > DIFF_CONTEXT) {
+			skipped = 1;
+			continue;
+		}
+		if (skipped) {
+			if (len)
+				text[len - 1] = '\n';
+			memcpy(&text[len], DIFF_ELLIPSIS " ", sizeof(DIFF_ELLIPSIS));
+			len += sizeof(DIFF_ELLIPSIS);
+			flags[count++] = 0;
+		}
+		skipped = 0;
+		if (steps[i].kind == STEP_DELETE) {
+			word = old_version.words[steps[i].word];
+			flags[count++] = WORD_DELETED;
+		} else {
+			word = new_version.words[steps[i].word];
+			flags[count++] = steps[i].kind == STEP_INSERT ? WORD_INSERTED : 0;
+		}
+		p = stpcpy(&text[len], word);
+		*p = ' ';
+		len = (size_t)(p - text) + 1;
+	}
+	text[len++] = '\0';
+	text[len++] = '\0';
+	text_size = len;
+
+	if (split_words())
+		goto fail;
+	for (i = 0; i < word_count && i < count; i++)
+		word_flags[i] |= flags[i];
+
+	free(flags);
+	return 0;
+
+fail:
+	free(flags);
+	free_words();
+	return -1;
+}
+
+
+/**
+ * Load two versions of a document, and keep only the words
+ * that have changed, and the words around them.
+ * 
+ * The changes are found by numbering the distinct words, leaving
+ * out the words that only occur in one of the versions, as they
+ * cannot be unchanged, and then finding the longest common
+ * subsequence of the remaining words in linear space. If the
+ * versions differ too much for that to be done quickly, a
+ * common subsequence that is nearly the longest is used.
+ * 
+ * @param   old_fd  The file descriptor to the old version.
+ * @param   new_fd  The file descriptor to the new version.
+ * @return          0 on success, -1 on error.
+ */
+int
+load_diff(int old_fd, int new_fd)
+{
+	struct version *versions[] = {&old_version, &new_version}, *v;
+	struct step *steps = NULL;
+	uint8_t *present[2] = {NULL, NULL};
+	size_t i, k, n;
+	uint32_t distinct;
+	int saved_errno;
+
+	if (load_file(old_fd))
+		return -1;
+	take_words(&old_version);
+	if (load_file(new_fd))
+		goto fail;
+	take_words(&new_version);
+
+	/* Collect the non-empty words. */
+	for (k = 0; k < 2; k++) {
+		v = versions[k];
+		v->words = malloc((v->count ? v->count : 1) * sizeof(*v->words));
+		if (!v->words)
+			goto fail;
+		for (i = n = 0; i < v->count; i++)
+			if (*(v->words[n] = &v->text[v->offsets[i]]))
+				n++;
+		v->count = n;
+	}
+
+	/* Leave out the words that only occur in one version. */
+	if (intern_words(&distinct))
+		goto fail;
+	for (k = 0; k < 2; k++) {
+		present[k] = calloc(distinct ? distinct : 1, 1);
+		if (!present[k])
+			goto fail;
+		for (i = 0; i < versions[k]->count; i++)
+			present[k][versions[k]->ids[i]] = 1;
+	}
+	if (prepare_version(&old_version, present[1]) || prepare_version(&new_version, present[0]))
+		goto fail;
+
+	/* Find the changes, giving up on a minimal difference
+	 * after about as many edits as the square root of the
+	 * number of words (as GNU diff does), as the time taken
+	 * is proportional to the product of the two. */
+	n = old_version.candidate_count + new_version.candidate_count + 3;
+	for (cost_limit = 1, k = n; k; k >>= 2)
+		cost_limit <<= 1;
+	cost_limit = cost_limit < DIFF_MIN_COST_LIMIT ? DIFF_MIN_COST_LIMIT : cost_limit;
+	forward_v = malloc(n * sizeof(*forward_v));
+	backward_v = malloc(n * sizeof(*backward_v));
+	if (!forward_v || !backward_v)
+		goto fail;
+	diff_range(old_version.candidates, old_version.candidate_count,
+	           new_version.candidates, new_version.candidate_count, 0, 0);
+
+	steps = get_steps(&n);
+	if (!steps || load_changes(steps, n))
+		goto fail;
+
+	free(steps);
+	free(present[0]);
+	free(present[1]);
+	free(forward_v);
+	free(backward_v);
+	forward_v = backward_v = NULL;
+	free_version(&old_version);
+	free_version(&new_version);
+	return 0;
+
+fail:
+	saved_errno = errno;
+	free(steps);
+	free(present[0]);
+	free(present[1]);
+	free(forward_v);
+	free(backward_v);
+	forward_v = backward_v = NULL;
+	free_version(&old_version);
+	free_version(&new_version);
+	free_words();
+	errno = saved_errno;
+	return -1;
+}
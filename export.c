@@ -0,0 +1,526 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The width of the terminal in recordings,
+ * unless overridden by $COLUMNS.
+ */
+#ifndef EXPORT_WIDTH
+# define EXPORT_WIDTH  80
+#endif
+
+/**
+ * The height of the terminal in recordings,
+ * unless overridden by $LINES.
+ */
+#ifndef EXPORT_HEIGHT
+# define EXPORT_HEIGHT  24
+#endif
+
+/**
+ * The number of records written at
+ * a time in the word stream format.
+ */
+#ifndef STREAM_BATCH
+# define STREAM_BATCH  256
+#endif
+
+/**
+ * The maximum number of frames whose differences
+ * are listed in the frame statistics.
+ */
+#ifndef MAX_LISTED_DIFFERENCES
+# define MAX_LISTED_DIFFERENCES  10
+#endif
+
+
+
+/**
+ * Should the records be written in real time?
+ */
+static int live = 0;
+
+/**
+ * The time the first word is displayed at,
+ * if the records are written in real time.
+ */
+static struct timespec start_time;
+
+
+
+/**
+ * Wait until it is time to write a record, if
+ * the records are written in real time.
+ * 
+ * @param   t  The time, in nanoseconds, of the record.
+ * @return     0 on success, -1 on error.
+ */
+static int
+await_record(long long t)
+{
+	struct timespec ts;
+	if (!live)
+		return 0;
+	if (fflush(stdout))
+		return -1;
+	ts.tv_sec = start_time.tv_sec + (time_t)(t / 1000000000LL);
+	ts.tv_nsec = start_time.tv_nsec + (long)(t % 1000000000LL);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000L;
+	}
+	while ((errno = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)))
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+
+/**
+ * Print a timestamp as used in subtitles.
+ * 
+ * @param  t    The time in nanoseconds.
+ * @param  sep  The character that separates the seconds from the milliseconds.
+ */
+static void
+print_timestamp(long long t, char sep)
+{
+	t /= 1000000LL;
+	printf("%02lli:%02lli:%02lli%c%03lli",
+	       t / 3600000, t / 60000 % 60, t / 1000 % 60, sep, t % 1000);
+}
+
+
+/**
+ * Print a word as WebVTT cue text.
+ * 
+ * @param  s  The word.
+ */
+static void
+print_vtt_text(const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '&')
+			fputs("&amp;", stdout);
+		else if (*s == '<')
+			fputs("&lt;", stdout);
+		else if (*s == '>')
+			fputs("&gt;", stdout);
+		else
+			putchar(*s);
+	}
+}
+
+
+/**
+ * Print a JSON string.
+ * 
+ * @param  s  The string.
+ * @param  n  The length of `s`.
+ */
+static void
+print_json_string(const char *s, size_t n)
+{
+	unsigned char c;
+	putchar('"');
+	for (; n--; s++) {
+		c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20 || c == 0x7F)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+
+/**
+ * Write data, from multiple buffers, to a file.
+ * 
+ * @param   fd   The file descriptor.
+ * @param   iov  The buffers, will be modified.
+ * @param   n    The number of elements in `iov`.
+ * @return       0 on success, -1 on error.
+ */
+static int
+write_iov(int fd, struct iovec *iov, size_t n)
+{
+	ssize_t r;
+	size_t len;
+	while (n) {
+		r = writev(fd, iov, (int)(n < IOV_MAX ? n : IOV_MAX));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (len = (size_t)r; n && len >= iov->iov_len; n--)
+			len -= (iov++)->iov_len;
+		if (n) {
+			iov->iov_base = &((char *)iov->iov_base)[len];
+			iov->iov_len -= len;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Get a terminal dimension from the environment.
+ * 
+ * @param   var  The name of the environment variable.
+ * @param   def  The value to use if the variable is not set.
+ * @return       The dimension.
+ */
+static size_t
+get_dimension(const char *var, size_t def)
+{
+	const char *s = getenv(var);
+	unsigned long r;
+	char *end;
+	if (!s || !isdigit(*s))
+		return def;
+	r = strtoul(s, &end, 10);
+	return (*end || !r || r > 10000) ? def : (size_t)r;
+}
+
+
+/**
+ * Write all words as WebVTT.
+ * 
+ * @param   pacer  The pacer for the words.
+ * @return         0 on success, -1 on error.
+ */
+static int
+export_vtt(struct pacer *pacer)
+{
+	long long t, end = 0;
+	size_t i;
+	printf("WEBVTT\n\n");
+	for (i = 0; i < word_count; i++) {
+		t = pacer_line(pacer, i, end);
+		end = t + pacer_next(pacer);
+		if (!*get_word(i))
+			continue;
+		if (await_record(t))
+			return -1;
+		print_timestamp(t, '.');
+		printf(" --> ");
+		print_timestamp(end, '.');
+		putchar('\n');
+		if (word_flags[i] & WORD_REVERSE_VIDEO)
+			printf("<i>");
+		if (word_flags[i] & WORD_WATCHED)
+			printf("<b>");
+		print_vtt_text(get_word(i));
+		if (word_flags[i] & WORD_WATCHED)
+			printf("</b>");
+		if (word_flags[i] & WORD_REVERSE_VIDEO)
+			printf("</i>");
+		printf("\n\n");
+	}
+	return 0;
+}
+
+
+/**
+ * Write all words as SubRip.
+ * 
+ * @param   pacer  The pacer for the words.
+ * @return         0 on success, -1 on error.
+ */
+static int
+export_srt(struct pacer *pacer)
+{
+	long long t, end = 0;
+	size_t i, n = 0;
+	for (i = 0; i < word_count; i++) {
+		t = pacer_line(pacer, i, end);
+		end = t + pacer_next(pacer);
+		if (!*get_word(i))
+			continue;
+		if (await_record(t))
+			return -1;
+		printf("%zu\n", ++n);
+		print_timestamp(t, ',');
+		printf(" --> ");
+		print_timestamp(end, ',');
+		printf("\n%s%s%s%s%s\n\n",
+		       (word_flags[i] & WORD_REVERSE_VIDEO) ? "<i>" : "",
+		       (word_flags[i] & WORD_WATCHED) ? "<b>" : "",
+		       get_word(i),
+		       (word_flags[i] & WORD_WATCHED) ? "</b>" : "",
+		       (word_flags[i] & WORD_REVERSE_VIDEO) ? "</i>" : "");
+	}
+	return 0;
+}
+
+
+/**
+ * Write all words as an asciicast (version 2) recording.
+ * 
+ * @param   pacer  The pacer for the words.
+ * @return         0 on success, -1 on error.
+ */
+static int
+export_cast(struct pacer *pacer)
+{
+	long long t = 0;
+	size_t i, size = 0, w, h;
+	char *buf = NULL;
+	void *new;
+	int r;
+
+	w = get_dimension("COLUMNS", EXPORT_WIDTH);
+	h = get_dimension("LINES", EXPORT_HEIGHT);
+	printf("{\"version\": 2, \"width\": %zu, \"height\": %zu}\n", w, h);
+
+	for (i = 0; i < word_count; i++) {
+		if (strlen(get_word(i)) + FRAME_OVERHEAD > size) {
+			size = strlen(get_word(i)) + FRAME_OVERHEAD;
+			new = realloc(buf, size);
+			if (!new) {
+				free(buf);
+				return -1;
+			}
+			buf = new;
+		}
+		r = format_word(buf, size, i, w, h);
+		if (r >= 0 && (size_t)r >= size)
+			r = -1, errno = EOVERFLOW;
+		t = pacer_line(pacer, i, t);
+		if (r < 0 || await_record(t)) {
+			free(buf);
+			return -1;
+		}
+		printf("[%lli.%06lli, \"o\", ", t / 1000000000LL, t / 1000LL % 1000000LL);
+		print_json_string(buf, (size_t)r);
+		printf("]\n");
+		t += pacer_next(pacer);
+	}
+	if (await_record(t)) {
+		free(buf);
+		return -1;
+	}
+	printf("[%lli.%06lli, \"o\", \"\\u001b[H\\u001b[2J\"]\n",
+	       t / 1000000000LL, t / 1000LL % 1000000LL);
+
+	free(buf);
+	return 0;
+}
+
+
+/**
+ * Write all words as a stream of records, one per line,
+ * for other programs to display. Each record is made up of
+ * the word's index, the time in nanoseconds it is displayed,
+ * its flags, and the word itself, separated by tab characters.
+ * 
+ * The words are written directly from the loaded text,
+ * in batches, without going through stdio.
+ * 
+ * @param   pacer  The pacer for the words.
+ * @return         0 on success, -1 on error.
+ */
+static int
+export_stream(struct pacer *pacer)
+{
+	static char headers[STREAM_BATCH][3 * 3 * sizeof(long long) + 4];
+	struct iovec iov[3 * STREAM_BATCH];
+	size_t i, n = 0, batch = live ? 1 : STREAM_BATCH;
+	long long t = 0;
+	int r;
+
+	for (i = 0; i < word_count; i++, t += pacer_next(pacer)) {
+		t = pacer_line(pacer, i, t);
+		if (await_record(t))
+			return -1;
+		r = sprintf(headers[n], "%zu\t%lli\t%u\t", i, t, (unsigned)word_flags[i]);
+		iov[3 * n + 0].iov_base = headers[n];
+		iov[3 * n + 0].iov_len = (size_t)r;
+		iov[3 * n + 1].iov_base = (void *)get_word(i);
+		iov[3 * n + 1].iov_len = strlen(get_word(i));
+		iov[3 * n + 2].iov_base = (void *)"\n";
+		iov[3 * n + 2].iov_len = 1;
+		if (++n == batch || i + 1 == word_count) {
+			if (write_iov(STDOUT_FILENO, iov, 3 * n))
+				return -1;
+			n = 0;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Print statistics of the frames written to a model of a terminal.
+ * 
+ * @param  name    The name of the way the frames were encoded.
+ * @param  vt      The model.
+ * @param  frames  The number of frames.
+ * @param  max     The length of the longest frame.
+ */
+static void
+print_frame_statistics(const char *name, const struct vt *vt, size_t frames, size_t max)
+{
+	double n = frames ? (double)frames : 1;
+	printf("%-8s %12zu bytes, %8.2f bytes per frame, %6.2f control functions per frame, longest frame %zu bytes\n",
+	       name, vt->bytes, (double)vt->bytes / n, (double)vt->controls / n, max);
+	if (vt->unsupported)
+		printf("%-8s %12zu control functions that are not modelled, the screen may differ from a terminal's\n",
+		       name, vt->unsupported);
+}
+
+
+/**
+ * Display all words in two models of a terminal, of the size
+ * in COLUMNS and LINES: one by clearing the screen for each
+ * word with `format_word`, and one with the frames that are
+ * written to the terminal, from `encode_frame`; check that the
+ * screens look the same after each word; and print how many
+ * bytes and control functions each way took.
+ * 
+ * @return  0 on success, 1 if the screens differed, -1 on error.
+ */
+static int
+export_frames(void)
+{
+	struct vt full, minimal;
+	size_t i, w, h, n, size = 0, row, col, repeats, differences = 0;
+	size_t full_max = 0, minimal_max = 0;
+	char *buf = NULL;
+	void *new;
+	int r;
+
+	w = get_dimension("COLUMNS", EXPORT_WIDTH);
+	h = get_dimension("LINES", EXPORT_HEIGHT);
+	if (vt_init(&full, w, h))
+		return -1;
+	if (vt_init(&minimal, w, h)) {
+		vt_destroy(&full);
+		return -1;
+	}
+	invalidate_frames();
+
+	for (i = 0; i < word_count; i++) {
+		if (strlen(get_word(i)) + 2 * FRAME_OVERHEAD > size) {
+			size = strlen(get_word(i)) + 2 * FRAME_OVERHEAD;
+			new = realloc(buf, size);
+			if (!new)
+				goto fail;
+			buf = new;
+		}
+		repeats = line_repeats(i);
+
+		r = format_word(buf, size, i, w, h);
+		if (r < 0 || (size_t)r >= size)
+			goto overflow;
+		n = (size_t)r;
+		if (repeats && h > 2) {
+			r = snprintf(&buf[n], size - n, "\033[%zu;%zuH(%zu repeats)",
+			             (h + 1) / 2 + 2, w / 2 > 6 ? w / 2 - 6 : 1, repeats);
+			if (r < 0 || (size_t)r >= size - n)
+				goto overflow;
+			n += (size_t)r;
+		}
+		vt_write(&full, buf, n);
+		full_max = n > full_max ? n : full_max;
+
+		r = encode_frame(buf, size, i, w, h, repeats);
+		if (r < 0 || (size_t)r >= size)
+			goto overflow;
+		vt_write(&minimal, buf, (size_t)r);
+		minimal_max = (size_t)r > minimal_max ? (size_t)r : minimal_max;
+
+		if (vt_differs(&full, &minimal, &row, &col) && differences++ < MAX_LISTED_DIFFERENCES)
+			printf("word %zu: the screens differ at row %zu, column %zu\n", i, row + 1, col + 1);
+	}
+
+	printf("%zu frames at %zux%zu, %zu differing\n", word_count, w, h, differences);
+	print_frame_statistics("full", &full, word_count, full_max);
+	print_frame_statistics("minimal", &minimal, word_count, minimal_max);
+
+	free(buf);
+	vt_destroy(&full);
+	vt_destroy(&minimal);
+	return differences ? 1 : 0;
+
+overflow:
+	if (r >= 0)
+		errno = EOVERFLOW;
+fail:
+	free(buf);
+	vt_destroy(&full);
+	vt_destroy(&minimal);
+	return -1;
+}
+
+
+/**
+ * Check whether a format can be passed to `export_words`.
+ * 
+ * @param   format  The format: "vtt" for WebVTT, "srt" for SubRip,
+ *                  "cast" for an asciicast recording, "words"
+ *                  for a stream of records for other programs,
+ *                  or "frames" for statistics of the frames that
+ *                  display the words, see `export_frames`.
+ * @return          1 if the format is recognised, 0 otherwise.
+ */
+int
+is_export_format(const char *format)
+{
+	return !strcmp(format, "vtt") || !strcmp(format, "srt") || !strcmp(format, "cast") ||
+	       !strcmp(format, "words") || !strcmp(format, "frames");
+}
+
+
+/**
+ * Write all words, with the times they are displayed, to stdout.
+ * 
+ * @param   format    The format to write the words in, see
+ *                    `is_export_format`.
+ * @param   rate      The number of words per minute,
+ *                    multiplied by `RATE_SCALE`.
+ * @param   schedule  The rate schedule, `NULL` for a constant rate.
+ * @param   replay    How lines are paced by their timestamps,
+ *                    `NULL` if only the words are paced.
+ * @param   realtime  Zero to write the words as fast as possible,
+ *                    non-zero to write the them in real time.
+ * @return            0 on success, 1 if the frames displayed
+ *                    different screens, -1 on error (`errno`
+ *                    is set to `EINVAL` if `format` is not
+ *                    recognised).
+ */
+int
+export_words(const char *format, long rate, const struct schedule *schedule,
+             const struct replay *replay, int realtime)
+{
+	struct pacer pacer;
+	int r;
+
+	live = realtime;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	pacer_init(&pacer, rate, schedule);
+	pacer_replay(&pacer, replay);
+
+	if (!strcmp(format, "vtt"))
+		r = export_vtt(&pacer);
+	else if (!strcmp(format, "srt"))
+		r = export_srt(&pacer);
+	else if (!strcmp(format, "cast"))
+		r = export_cast(&pacer);
+	else if (!strcmp(format, "words"))
+		return export_stream(&pacer);
+	else if (!strcmp(format, "frames"))
+		r = export_frames();
+	else
+		return errno = EINVAL, -1;
+
+	if (r < 0 || fflush(stdout) || ferror(stdout))
+		return -1;
+	return r;
+}
@@ -0,0 +1,726 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The maximum number of fields that can be extracted.
+ */
+#ifndef MAX_FIELDS
+# define MAX_FIELDS  32
+#endif
+
+
+
+/**
+ * A field to extract from each record.
+ */
+struct field {
+	/**
+	 * For JSON records, the path of the member, without
+	 * the leading '.'; for delimited records, the name
+	 * of the column in the header, `NULL` if the
+	 * column is given by `column`.
+	 */
+	const char *name;
+
+	/**
+	 * The length of `name`.
+	 */
+	size_t name_len;
+
+	/**
+	 * For delimited records, the number of the column,
+	 * starting at 1, 0 if no column has the name `name`.
+	 */
+	size_t column;
+};
+
+/**
+ * A column in a delimited record.
+ */
+struct span {
+	/**
+	 * The contents of the column, without quotes.
+	 */
+	const char *s;
+
+	/**
+	 * The length of `s`.
+	 */
+	size_t n;
+
+	/**
+	 * Whether the column was quoted, in which
+	 * case "" in `s` is a quotation mark.
+	 */
+	int quoted;
+};
+
+
+
+/**
+ * The fields to extract, in the order
+ * they shall be displayed.
+ */
+static struct field fields[MAX_FIELDS];
+
+/**
+ * The number of elements in `fields`.
+ */
+static size_t field_count = 0;
+
+/**
+ * Are the records JSON objects, rather
+ * than delimited records?
+ */
+static int json;
+
+/**
+ * The text built from the extracted fields.
+ */
+static char *out = NULL;
+
+/**
+ * The length of `out`.
+ */
+static size_t out_len = 0;
+
+/**
+ * The allocation size of `out`.
+ */
+static size_t out_size = 0;
+
+/**
+ * The columns of the current delimited record.
+ */
+static struct span *spans = NULL;
+
+/**
+ * The allocation size of `spans`.
+ */
+static size_t span_capacity = 0;
+
+
+
+/**
+ * Add fields to extract from each record, rather than
+ * splitting the entire text into words. Each field is
+ * displayed as its own line.
+ * 
+ * `spec` is a comma-separated list of fields. A field that
+ * starts with '.' is the path, with members separated by '.',
+ * of a member in JSON records, a number is the number of a
+ * column in CSV or TSV records, and anything else is the name
+ * of a column in the header, the first record, of CSV or TSV
+ * records. JSON fields cannot be mixed with columns.
+ * 
+ * @param   spec  The fields, must not be deallocated
+ *                while the fields are in use.
+ * @return        0 on success, -1 on error (`errno` is set
+ *                to `EINVAL` if `spec` is invalid).
+ */
+int
+add_fields(const char *spec)
+{
+	struct field *f;
+	const char *end;
+	size_t i;
+
+	for (;; spec = &end[1]) {
+		end = strchr(spec, ',');
+		if (!end)
+			end = strchr(spec, '\0');
+		if (field_count == MAX_FIELDS)
+			return errno = E2BIG, -1;
+		if (end == spec || (field_count && json != (*spec == '.')))
+			return errno = EINVAL, -1;
+		json = *spec == '.';
+
+		f = &fields[field_count++];
+		f->name = &spec[json];
+		f->name_len = (size_t)(end - f->name);
+		f->column = 0;
+		if (json) {
+			for (i = 0; i <= f->name_len; i++)
+				if (i == f->name_len || f->name[i] == '.')
+					if (!i || f->name[i - 1] == '.')
+						return errno = EINVAL, -1;
+		} else if (strspn(spec, "0123456789") == (size_t)(end - spec)) {
+			for (; spec != end; spec++) {
+				if (f->column > (SIZE_MAX - 9) / 10)
+					return errno = EINVAL, -1;
+				f->column = f->column * 10 + (size_t)(*spec - '0');
+			}
+			if (!f->column)
+				return errno = EINVAL, -1;
+			f->name = NULL;
+		}
+
+		if (!*end)
+			return 0;
+	}
+}
+
+
+/**
+ * Remove all fields to extract.
+ */
+void
+free_fields(void)
+{
+	field_count = 0;
+	free(spans);
+	spans = NULL;
+	span_capacity = 0;
+}
+
+
+/**
+ * Append data to the text built from the extracted fields.
+ * 
+ * @param   s  The data.
+ * @param   n  The length of `s`.
+ * @return     0 on success, -1 on error.
+ */
+static int
+append(const char *s, size_t n)
+{
+	void *new;
+	if (n > out_size - out_len) {
+		do {
+			if (out_size > SIZE_MAX / 2)
+				return errno = ENOMEM, -1;
+			out_size = out_size ? out_size << 1 : 8 << 10;
+		} while (n > out_size - out_len);
+		new = realloc(out, out_size);
+		if (!new)
+			return -1;
+		out = new;
+	}
+	memcpy(&out[out_len], s, n);
+	out_len += n;
+	return 0;
+}
+
+
+/**
+ * Find the first occurrence of either of two bytes.
+ * 
+ * Eight bytes are tested at a time, using a test that is
+ * true if any of them is equal to either byte; the bytes
+ * are only tested one by one in the eight bytes that
+ * contain a match, and at the end of the text.
+ * 
+ * @param   s    The text to search.
+ * @param   end  The end of `s`.
+ * @param   a    One of the bytes.
+ * @param   b    The other byte.
+ * @return       The first occurrence, `end` if none.
+ */
+static const char *
+find_either(const char *s, const char *end, char a, char b)
+{
+	const uint64_t ones = UINT64_C(0x0101010101010101), highs = ones << 7;
+	uint64_t w, x, y;
+
+	for (; end - s >= 8; s += 8) {
+		memcpy(&w, s, 8);
+		x = w ^ (ones * (unsigned char)a);
+		y = w ^ (ones * (unsigned char)b);
+		if (((x - ones) & ~x & highs) | ((y - ones) & ~y & highs))
+			break;
+	}
+	for (; s != end; s++)
+		if (*s == a || *s == b)
+			break;
+	return s;
+}
+
+
+/**
+ * Skip whitespace.
+ * 
+ * @param   s    The text.
+ * @param   end  The end of `s`.
+ * @return       The first byte in `s` that is not
+ *               whitespace, `end` if none.
+ */
+static const char *
+skip_space(const char *s, const char *end)
+{
+	while (s != end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n'))
+		s++;
+	return s;
+}
+
+
+/**
+ * Skip the rest of a JSON string.
+ * 
+ * @param   s    The byte after the opening quotation mark.
+ * @param   end  The end of the text.
+ * @return       The byte after the closing quotation
+ *               mark, `NULL` if the string is unterminated.
+ */
+static const char *
+skip_string(const char *s, const char *end)
+{
+	for (;;) {
+		s = find_either(s, end, '"', '\\');
+		if (s == end)
+			return NULL;
+		if (*s++ == '"')
+			return s;
+		if (s++ == end)
+			return NULL;
+	}
+}
+
+
+/**
+ * Skip a JSON value.
+ * 
+ * Values are only validated as far as is needed
+ * to find where they end.
+ * 
+ * @param   s    The first byte of the value.
+ * @param   end  The end of the text.
+ * @return       The byte after the value,
+ *               `NULL` if it is malformed.
+ */
+static const char *
+skip_value(const char *s, const char *end)
+{
+	size_t depth = 0;
+	const char *start;
+
+	do {
+		s = skip_space(s, end);
+		if (s == end)
+			return NULL;
+		if (*s == '"') {
+			s = skip_string(&s[1], end);
+			if (!s)
+				return NULL;
+		} else if (*s == '{' || *s == '[') {
+			depth++;
+			s++;
+		} else if (*s == '}' || *s == ']') {
+			if (!depth--)
+				return NULL;
+			s++;
+		} else if (*s == ',' || *s == ':') {
+			if (!depth)
+				return NULL;
+			s++;
+		} else {
+			for (start = s; s != end && *s && !strchr(",:{}[]\" \t\r\n", *s); s++);
+			if (s == start)
+				return NULL;
+		}
+	} while (depth);
+
+	return s;
+}
+
+
+/**
+ * Find a member in a JSON object.
+ * 
+ * @param   s    The opening brace of the object.
+ * @param   end  The end of the text.
+ * @param   key  The name of the member, without escapes.
+ * @param   n    The length of `key`.
+ * @return       The value of the member, `NULL` if
+ *               the object has no such member.
+ */
+static const char *
+find_member(const char *s, const char *end, const char *key, size_t n)
+{
+	const char *k;
+	int match;
+
+	s = skip_space(&s[1], end);
+	if (s != end && *s == '}')
+		return NULL;
+
+	for (;;) {
+		if (s == end || *s != '"')
+			return NULL;
+		k = &s[1];
+		s = skip_string(k, end);
+		if (!s)
+			return NULL;
+		match = (size_t)(s - 1 - k) == n && !memcmp(k, key, n);
+		s = skip_space(s, end);
+		if (s == end || *s++ != ':')
+			return NULL;
+		s = skip_space(s, end);
+		if (match)
+			return s;
+		s = skip_value(s, end);
+		if (!s)
+			return NULL;
+		s = skip_space(s, end);
+		if (s == end || *s++ != ',')
+			return NULL;
+		s = skip_space(s, end);
+	}
+}
+
+
+/**
+ * Append a character, encoded in UTF-8, to the
+ * text built from the extracted fields.
+ * 
+ * @param   c  The character.
+ * @return     0 on success, -1 on error.
+ */
+static int
+append_utf8(uint32_t c)
+{
+	char buf[4];
+	if (c < 0x80) {
+		buf[0] = (char)c;
+		return append(buf, 1);
+	} else if (c < 0x800) {
+		buf[0] = (char)(0xC0 | (c >> 6));
+		buf[1] = (char)(0x80 | (c & 0x3F));
+		return append(buf, 2);
+	} else if (c < 0x10000) {
+		buf[0] = (char)(0xE0 | (c >> 12));
+		buf[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		buf[2] = (char)(0x80 | (c & 0x3F));
+		return append(buf, 3);
+	} else {
+		buf[0] = (char)(0xF0 | (c >> 18));
+		buf[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+		buf[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+		buf[3] = (char)(0x80 | (c & 0x3F));
+		return append(buf, 4);
+	}
+}
+
+
+/**
+ * Parse the four hexadecimal digits of a \u escape.
+ * 
+ * @param   s    The first digit.
+ * @param   end  The end of the text.
+ * @return       The value, -1 if the digits are invalid.
+ */
+static long
+parse_hex4(const char *s, const char *end)
+{
+	long r = 0;
+	int i;
+	if (end - s < 4)
+		return -1;
+	for (i = 0; i < 4; i++) {
+		if (!isxdigit(s[i]))
+			return -1;
+		r = r * 16 + (isdigit(s[i]) ? s[i] - '0' : (tolower(s[i]) - 'a' + 10));
+	}
+	return r;
+}
+
+
+/**
+ * Append a JSON string, without its quotation marks and with
+ * its escapes decoded, to the text built from the extracted fields.
+ * 
+ * @param   s    The byte after the opening quotation mark.
+ * @param   end  The closing quotation mark.
+ * @return       0 on success, -1 on error.
+ */
+static int
+append_json_string(const char *s, const char *end)
+{
+	const char *p;
+	long c, c2;
+
+	for (;;) {
+		p = memchr(s, '\\', (size_t)(end - s));
+		if (!p)
+			return append(s, (size_t)(end - s));
+		if (append(s, (size_t)(p - s)))
+			return -1;
+		s = &p[2];
+		switch (p[1]) {
+		case 'b':
+		case 'f':
+			c = ' ';
+			break;
+		case 'n':
+			c = '\n';
+			break;
+		case 'r':
+			c = '\r';
+			break;
+		case 't':
+			c = '\t';
+			break;
+		case 'u':
+			c = parse_hex4(s, end);
+			if (c < 0) {
+				c = 0xFFFD;
+				break;
+			}
+			s = &s[4];
+			if (c >= 0xD800 && c <= 0xDBFF && end - s >= 6 && s[0] == '\\' && s[1] == 'u') {
+				c2 = parse_hex4(&s[2], end);
+				if (c2 >= 0xDC00 && c2 <= 0xDFFF) {
+					c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+					s = &s[6];
+				}
+			}
+			if ((c >= 0xD800 && c <= 0xDFFF) || !c)
+				c = 0xFFFD;
+			break;
+		default:
+			c = (unsigned char)p[1];
+			break;
+		}
+		if (append_utf8((uint32_t)c))
+			return -1;
+	}
+}
+
+
+/**
+ * Append the fields of a JSON record to the
+ * text built from the extracted fields.
+ * 
+ * @param   s    The opening brace of the record.
+ * @param   end  The byte after the closing brace.
+ * @return       0 on success, -1 on error.
+ */
+static int
+extract_json_record(const char *s, const char *end)
+{
+	const char *v, *name, *name_end, *dot, *value_end;
+	size_t i;
+
+	for (i = 0; i < field_count; i++) {
+		v = s;
+		name = fields[i].name;
+		name_end = &name[fields[i].name_len];
+		for (; v && name < name_end; name = &dot[1]) {
+			dot = memchr(name, '.', (size_t)(name_end - name));
+			if (!dot)
+				dot = name_end;
+			v = *v == '{' ? find_member(v, end, name, (size_t)(dot - name)) : NULL;
+			if (dot == name_end)
+				break;
+		}
+		if (!v || !(value_end = skip_value(v, end)))
+			continue;
+		if (*v == '"' ? append_json_string(&v[1], &value_end[-1]) : append(v, (size_t)(value_end - v)))
+			return -1;
+		if (append("\n", 1))
+			return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Extract the fields from text with one JSON object per line.
+ * Lines that are not JSON objects are kept as they are.
+ * 
+ * @param   s    The text.
+ * @param   end  The end of `s`.
+ * @return       0 on success, -1 on error.
+ */
+static int
+extract_json(const char *s, const char *end)
+{
+	const char *line_end, *p, *obj_end;
+
+	while (s != end) {
+		line_end = memchr(s, '\n', (size_t)(end - s));
+		line_end = line_end ? &line_end[1] : end;
+		for (p = s; p != line_end && (*p == ' ' || *p == '\t'); p++);
+		if (p != line_end && *p == '{' && (obj_end = skip_value(p, end))) {
+			if (extract_json_record(p, obj_end))
+				return -1;
+			/* The object may span multiple lines, anything
+			 * after it on its last line is ignored. */
+			line_end = memchr(obj_end, '\n', (size_t)(end - obj_end));
+			line_end = line_end ? &line_end[1] : end;
+		} else if (append(s, (size_t)(line_end - s))) {
+			return -1;
+		}
+		s = line_end;
+	}
+	return 0;
+}
+
+
+/**
+ * Append a column, with "" in quoted columns decoded,
+ * to the text built from the extracted fields.
+ * 
+ * @param   span  The column.
+ * @return        0 on success, -1 on error.
+ */
+static int
+append_column(const struct span *span)
+{
+	const char *s = span->s, *end = &s[span->n], *p;
+	if (!span->quoted)
+		return append(s, span->n);
+	while ((p = memchr(s, '"', (size_t)(end - s)))) {
+		if (append(s, (size_t)(&p[1] - s)))
+			return -1;
+		s = &p[2];
+	}
+	return append(s, (size_t)(end - s));
+}
+
+
+/**
+ * Split a delimited record into its columns, which
+ * are stored in `spans`. In CSV records, a column can
+ * be quoted, in which case it can contain delimiters
+ * and line breaks.
+ * 
+ * @param   s       The first byte of the record.
+ * @param   end     The end of the text.
+ * @param   delim   The byte that separates columns.
+ * @param   countp  Output parameter for the number of columns.
+ * @return          The first byte of the next record, `NULL` on error.
+ */
+static const char *
+split_record(const char *s, const char *end, char delim, size_t *countp)
+{
+	const char *p;
+	size_t n = 0;
+	void *new;
+
+	for (;;) {
+		if (n == span_capacity) {
+			span_capacity = span_capacity ? span_capacity << 1 : 16;
+			new = realloc(spans, span_capacity * sizeof(*spans));
+			if (!new)
+				return NULL;
+			spans = new;
+		}
+		if (delim == ',' && s != end && *s == '"') {
+			for (p = &s[1]; (p = memchr(p, '"', (size_t)(end - p))) && &p[1] != end && p[1] == '"'; p = &p[2]);
+			if (!p)
+				p = end;
+			spans[n].s = &s[1];
+			spans[n].n = (size_t)(p - &s[1]);
+			spans[n].quoted = 1;
+			s = p == end ? end : find_either(&p[1], end, delim, '\n');
+		} else {
+			p = find_either(s, end, delim, '\n');
+			spans[n].s = s;
+			spans[n].n = (size_t)(p - s);
+			spans[n].n -= spans[n].n && p != end && *p == '\n' && p[-1] == '\r';
+			spans[n].quoted = 0;
+			s = p;
+		}
+		n++;
+		if (s == end || *s++ == '\n')
+			break;
+	}
+
+	*countp = n;
+	return s;
+}
+
+
+/**
+ * Extract the fields from CSV or TSV text. The text
+ * is TSV if its first line contains a tab character.
+ * 
+ * @param   s    The text.
+ * @param   end  The end of `s`.
+ * @return       0 on success, -1 on error.
+ */
+static int
+extract_delimited(const char *s, const char *end)
+{
+	const char *line_end;
+	size_t i, j, n, count;
+	char delim;
+
+	line_end = memchr(s, '\n', (size_t)(end - s));
+	delim = memchr(s, '\t', (size_t)((line_end ? line_end : end) - s)) ? '\t' : ',';
+
+	/* Look up the columns given by name in the header. */
+	for (i = 0; i < field_count; i++)
+		if (fields[i].name)
+			break;
+	if (i < field_count && s != end) {
+		s = split_record(s, end, delim, &count);
+		if (!s)
+			return -1;
+		for (i = 0; i < field_count; i++) {
+			if (!fields[i].name)
+				continue;
+			fields[i].column = 0;
+			for (j = 0; j < count && !fields[i].column; j++) {
+				n = out_len;
+				if (append_column(&spans[j]))
+					return -1;
+				if (out_len - n == fields[i].name_len && !memcmp(&out[n], fields[i].name, fields[i].name_len))
+					fields[i].column = j + 1;
+				out_len = n;
+			}
+		}
+	}
+
+	while (s != end) {
+		s = split_record(s, end, delim, &count);
+		if (!s)
+			return -1;
+		for (i = 0; i < field_count; i++) {
+			j = fields[i].column;
+			if (!j || j > count || !spans[j - 1].n)
+				continue;
+			if (append_column(&spans[j - 1]) || append("\n", 1))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Replace the loaded text with the fields extracted
+ * from its records, one field per line, so that each
+ * field starts at a new line. Does nothing if no
+ * fields have been added with `add_fields`.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+int
+extract_fields(void)
+{
+	const char *end;
+	int r;
+
+	if (!field_count || !text)
+		return 0;
+
+	end = &text[text_size - 2];
+	out_len = 0;
+	r = json ? extract_json(text, end) : extract_delimited(text, end);
+	if (r || append("\0\0", 2)) {
+		free(out);
+		out = NULL;
+		out_len = out_size = 0;
+		return -1;
+	}
+
+	free(text);
+	text = out;
+	text_size = out_len;
+	out = NULL;
+	out_len = out_size = 0;
+	return 0;
+}
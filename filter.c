@@ -0,0 +1,867 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The maximum number of line filters.
+ */
+#ifndef MAX_FILTERS
+# define MAX_FILTERS  16
+#endif
+
+/**
+ * The maximum number of states in the cache of
+ * constructed DFA states of a filter. If more states
+ * are needed, the cache is emptied and the states
+ * are constructed again as they are needed.
+ */
+#ifndef DFA_CACHE_SIZE
+# define DFA_CACHE_SIZE  2048
+#endif
+
+/**
+ * Marks a transition, or a start state,
+ * that has not been constructed yet.
+ */
+#define UNKNOWN  (-1)
+
+
+
+/**
+ * Kinds of NFA nodes.
+ */
+enum node_type {
+	/**
+	 * Consume a byte in a set of bytes.
+	 */
+	NODE_SET,
+
+	/**
+	 * Continue at both `out` and `out1`.
+	 */
+	NODE_SPLIT,
+
+	/**
+	 * Continue at `out`.
+	 */
+	NODE_JUMP,
+
+	/**
+	 * Continue at `out` if at the beginning of the line.
+	 */
+	NODE_BOL,
+
+	/**
+	 * Continue at `out` if at the end of the line.
+	 */
+	NODE_EOL,
+
+	/**
+	 * The pattern has matched.
+	 */
+	NODE_MATCH
+};
+
+/**
+ * A node in a filter's NFA.
+ */
+struct node {
+	/**
+	 * The kind of node.
+	 */
+	enum node_type type;
+
+	/**
+	 * The next node.
+	 */
+	uint32_t out;
+
+	/**
+	 * The alternative next node, for `NODE_SPLIT`.
+	 */
+	uint32_t out1;
+
+	/**
+	 * The bytes that can be consumed, for `NODE_SET`.
+	 */
+	uint64_t set[4];
+};
+
+/**
+ * A part of an NFA being compiled.
+ */
+struct fragment {
+	/**
+	 * The first node.
+	 */
+	uint32_t start;
+
+	/**
+	 * The last node, a `NODE_JUMP` whose `out`
+	 * is set when the fragment is connected.
+	 */
+	uint32_t end;
+};
+
+/**
+ * A state in a filter's lazily constructed DFA.
+ */
+struct dfa_state {
+	/**
+	 * The NFA nodes, that consume bytes or
+	 * are assertions, the state is made up of.
+	 */
+	uint32_t *nodes;
+
+	/**
+	 * The number of elements in `nodes`.
+	 */
+	size_t node_count;
+
+	/**
+	 * The state to go to for each byte,
+	 * `UNKNOWN` if not constructed yet.
+	 */
+	int32_t next[256];
+
+	/**
+	 * Has the pattern matched?
+	 */
+	int match;
+
+	/**
+	 * Has the pattern matched if the line ends here?
+	 */
+	int match_at_eol;
+};
+
+/**
+ * A line filter.
+ */
+struct filter {
+	/**
+	 * Whether lines that match are removed,
+	 * rather than lines that do not match.
+	 */
+	int exclude;
+
+	/**
+	 * The NFA.
+	 */
+	struct node *nodes;
+
+	/**
+	 * The number of elements in `nodes`.
+	 */
+	size_t node_count;
+
+	/**
+	 * The allocation size of `nodes`.
+	 */
+	size_t node_capacity;
+
+	/**
+	 * The first node of the NFA.
+	 */
+	uint32_t start;
+
+	/**
+	 * The constructed DFA states.
+	 */
+	struct dfa_state *states;
+
+	/**
+	 * The number of elements in `states`.
+	 */
+	size_t state_count;
+
+	/**
+	 * The number of times the cache of
+	 * DFA states has been emptied.
+	 */
+	size_t flushes;
+
+	/**
+	 * The DFA state at the beginning of
+	 * a line, `UNKNOWN` if not constructed.
+	 */
+	int32_t start_state;
+
+	/**
+	 * Scratch space for sets of NFA nodes,
+	 * `node_count` elements each.
+	 */
+	uint32_t *set, *stack, *marks;
+
+	/**
+	 * The value in `marks` for nodes that
+	 * have been added to `set`.
+	 */
+	uint32_t generation;
+};
+
+
+
+/**
+ * The line filters.
+ */
+static struct filter filters[MAX_FILTERS];
+
+/**
+ * The number of elements in `filters`.
+ */
+static size_t filter_count = 0;
+
+/**
+ * The rest of the pattern being compiled.
+ */
+static const char *pattern;
+
+/**
+ * The filter being compiled.
+ */
+static struct filter *compiling;
+
+
+
+/**
+ * Add a node to the filter being compiled.
+ * 
+ * @param   type  The kind of node.
+ * @return        The index of the node, `UINT32_MAX` on error.
+ */
+static uint32_t
+new_node(enum node_type type)
+{
+	struct filter *f = compiling;
+	void *new;
+	if (f->node_count == f->node_capacity) {
+		if (f->node_count >= UINT32_MAX / 4)
+			return errno = ENOMEM, UINT32_MAX;
+		f->node_capacity = f->node_capacity ? f->node_capacity << 1 : 16;
+		new = realloc(f->nodes, f->node_capacity * sizeof(*f->nodes));
+		if (!new)
+			return UINT32_MAX;
+		f->nodes = new;
+	}
+	memset(&f->nodes[f->node_count], 0, sizeof(*f->nodes));
+	f->nodes[f->node_count].type = type;
+	return (uint32_t)f->node_count++;
+}
+
+
+/**
+ * Create a fragment made up of one node.
+ * 
+ * @param   fragp  Output parameter for the fragment.
+ * @param   type   The kind of node.
+ * @return         0 on success, -1 on error.
+ */
+static int
+single(struct fragment *fragp, enum node_type type)
+{
+	fragp->start = new_node(type);
+	if (fragp->start == UINT32_MAX)
+		return -1;
+	fragp->end = new_node(NODE_JUMP);
+	if (fragp->end == UINT32_MAX)
+		return -1;
+	compiling->nodes[fragp->start].out = fragp->end;
+	return 0;
+}
+
+
+/**
+ * Add a byte to a set of bytes.
+ * 
+ * @param  set  The set.
+ * @param  c    The byte.
+ */
+static void
+set_add(uint64_t set[4], unsigned char c)
+{
+	set[c >> 6] |= UINT64_C(1) << (c & 63);
+}
+
+
+/**
+ * Add the bytes of a class escape, such
+ * as \d, to a set of bytes.
+ * 
+ * @param   set  The set.
+ * @param   c    The character after the backslash.
+ * @return       1 if `c` is a class, 0 if it is
+ *               a literal character.
+ */
+static int
+set_add_class(uint64_t set[4], char c)
+{
+	int (*is)(int);
+	int i;
+	switch (c) {
+	case 'd': is = isdigit; break;
+	case 's': is = isspace; break;
+	case 'w': is = isalnum; break;
+	default:
+		return 0;
+	}
+	for (i = 0; i < 256; i++)
+		if (is(i) || (c == 'w' && i == '_'))
+			set_add(set, (unsigned char)i);
+	return 1;
+}
+
+
+static int parse_alternation(struct fragment *fragp);
+
+
+/**
+ * Parse a bracket expression, such as [a-z], after the '['.
+ * 
+ * @param   set  Output parameter for the bytes it matches.
+ * @return       0 on success, -1 on error.
+ */
+static int
+parse_bracket(uint64_t set[4])
+{
+	int negate = 0, i, first = 1;
+	unsigned char lo, hi;
+
+	if (*pattern == '^')
+		negate = 1, pattern++;
+	for (; *pattern && (first || *pattern != ']'); first = 0) {
+		if (*pattern == '\\' && pattern[1]) {
+			if (set_add_class(set, pattern[1])) {
+				pattern += 2;
+				continue;
+			}
+			pattern++;
+		}
+		lo = hi = (unsigned char)*pattern++;
+		if (*pattern == '-' && pattern[1] && pattern[1] != ']') {
+			pattern++;
+			if (*pattern == '\\' && pattern[1])
+				pattern++;
+			hi = (unsigned char)*pattern++;
+			if (hi < lo)
+				return errno = EINVAL, -1;
+		}
+		for (i = lo; i <= hi; i++)
+			set_add(set, (unsigned char)i);
+	}
+	if (*pattern++ != ']')
+		return errno = EINVAL, -1;
+
+	if (negate)
+		for (i = 0; i < 4; i++)
+			set[i] = ~set[i];
+	return 0;
+}
+
+
+/**
+ * Parse an atom: a character, a bracket expression,
+ * a dot, an anchor, or a parenthesised expression.
+ * 
+ * @param   fragp  Output parameter for the fragment.
+ * @return         0 on success, -1 on error.
+ */
+static int
+parse_atom(struct fragment *fragp)
+{
+	uint64_t *set;
+	char c = *pattern++;
+
+	if (c == '(') {
+		if (parse_alternation(fragp))
+			return -1;
+		if (*pattern++ != ')')
+			return errno = EINVAL, -1;
+		return 0;
+	} else if (c == '^') {
+		return single(fragp, NODE_BOL);
+	} else if (c == '$') {
+		return single(fragp, NODE_EOL);
+	} else if (c == '*' || c == '+' || c == '?' || c == ')') {
+		return errno = EINVAL, -1;
+	}
+
+	if (single(fragp, NODE_SET))
+		return -1;
+	set = compiling->nodes[fragp->start].set;
+	if (c == '[') {
+		return parse_bracket(set);
+	} else if (c == '.') {
+		memset(set, 0xFF, sizeof(compiling->nodes->set));
+		set[0] &= ~(UINT64_C(1) << '\n');
+	} else if (c == '\\') {
+		if (!*pattern)
+			return errno = EINVAL, -1;
+		c = *pattern++;
+		if (!set_add_class(set, c))
+			set_add(set, (unsigned char)c);
+	} else {
+		set_add(set, (unsigned char)c);
+	}
+	return 0;
+}
+
+
+/**
+ * Parse an atom and the repetition operators after it.
+ * 
+ * @param   fragp  Output parameter for the fragment.
+ * @return         0 on success, -1 on error.
+ */
+static int
+parse_repetition(struct fragment *fragp)
+{
+	struct node *nodes;
+	uint32_t split, end;
+
+	if (parse_atom(fragp))
+		return -1;
+
+	while (*pattern == '*' || *pattern == '+' || *pattern == '?') {
+		split = new_node(NODE_SPLIT);
+		if (split == UINT32_MAX)
+			return -1;
+		end = new_node(NODE_JUMP);
+		if (end == UINT32_MAX)
+			return -1;
+		nodes = compiling->nodes;
+		nodes[split].out = fragp->start;
+		nodes[split].out1 = end;
+		nodes[fragp->end].out = *pattern == '?' ? end : split;
+		if (*pattern != '+')
+			fragp->start = split;
+		fragp->end = end;
+		pattern++;
+	}
+	return 0;
+}
+
+
+/**
+ * Parse a sequence of atoms.
+ * 
+ * @param   fragp  Output parameter for the fragment.
+ * @return         0 on success, -1 on error.
+ */
+static int
+parse_concatenation(struct fragment *fragp)
+{
+	struct fragment next;
+
+	fragp->start = fragp->end = new_node(NODE_JUMP);
+	if (fragp->start == UINT32_MAX)
+		return -1;
+
+	while (*pattern && *pattern != '|' && *pattern != ')') {
+		if (parse_repetition(&next))
+			return -1;
+		compiling->nodes[fragp->end].out = next.start;
+		fragp->end = next.end;
+	}
+	return 0;
+}
+
+
+/**
+ * Parse alternatives separated by '|'.
+ * 
+ * @param   fragp  Output parameter for the fragment.
+ * @return         0 on success, -1 on error.
+ */
+static int
+parse_alternation(struct fragment *fragp)
+{
+	struct fragment next;
+	uint32_t split, end;
+
+	if (parse_concatenation(fragp))
+		return -1;
+
+	while (*pattern == '|') {
+		pattern++;
+		if (parse_concatenation(&next))
+			return -1;
+		split = new_node(NODE_SPLIT);
+		if (split == UINT32_MAX)
+			return -1;
+		end = new_node(NODE_JUMP);
+		if (end == UINT32_MAX)
+			return -1;
+		compiling->nodes[split].out = fragp->start;
+		compiling->nodes[split].out1 = next.start;
+		compiling->nodes[fragp->end].out = end;
+		compiling->nodes[next.end].out = end;
+		fragp->start = split;
+		fragp->end = end;
+	}
+	return 0;
+}
+
+
+/**
+ * Add a line filter, so that only lines that match a pattern, or
+ * only lines that do not match a pattern, are loaded. Lines are kept
+ * if they match any of the including filters, if there are any,
+ * and none of the excluding filters.
+ * 
+ * The pattern is an extended regular expression with the operators
+ * | * + ? ( ) [ ] . ^ and $, the classes \d, \s and \w, and \ to
+ * escape an operator. The pattern may match any part of the line.
+ * 
+ * @param   regex    The pattern.
+ * @param   exclude  Whether lines that match shall be removed,
+ *                   rather than lines that do not match.
+ * @return           0 on success, -1 on error (`errno` is
+ *                   set to `EINVAL` if the pattern is invalid).
+ */
+int
+add_line_filter(const char *regex, int exclude)
+{
+	struct fragment frag;
+	uint32_t match;
+	size_t n;
+
+	if (filter_count == MAX_FILTERS)
+		return errno = E2BIG, -1;
+	compiling = &filters[filter_count];
+	memset(compiling, 0, sizeof(*compiling));
+	compiling->exclude = exclude;
+	compiling->start_state = UNKNOWN;
+
+	pattern = regex;
+	if (parse_alternation(&frag))
+		goto fail;
+	if (*pattern) {
+		errno = EINVAL;
+		goto fail;
+	}
+	match = new_node(NODE_MATCH);
+	if (match == UINT32_MAX)
+		goto fail;
+	compiling->nodes[frag.end].out = match;
+	compiling->start = frag.start;
+
+	n = compiling->node_count;
+	compiling->set = malloc(n * sizeof(*compiling->set));
+	compiling->stack = malloc(n * sizeof(*compiling->stack));
+	compiling->marks = calloc(n, sizeof(*compiling->marks));
+	compiling->states = malloc(DFA_CACHE_SIZE * sizeof(*compiling->states));
+	if (!compiling->set || !compiling->stack || !compiling->marks || !compiling->states)
+		goto fail;
+
+	filter_count++;
+	return 0;
+
+fail:
+	free(compiling->nodes);
+	free(compiling->set);
+	free(compiling->stack);
+	free(compiling->marks);
+	free(compiling->states);
+	return -1;
+}
+
+
+/**
+ * Remove all constructed DFA states of a filter.
+ * 
+ * @param  f  The filter.
+ */
+static void
+flush_states(struct filter *f)
+{
+	while (f->state_count)
+		free(f->states[--f->state_count].nodes);
+	f->start_state = UNKNOWN;
+	f->flushes++;
+}
+
+
+/**
+ * Remove all line filters.
+ */
+void
+free_line_filters(void)
+{
+	struct filter *f;
+	while (filter_count) {
+		f = &filters[--filter_count];
+		flush_states(f);
+		free(f->nodes);
+		free(f->set);
+		free(f->stack);
+		free(f->marks);
+		free(f->states);
+	}
+}
+
+
+/**
+ * Add an NFA node, and the nodes that can be reached
+ * from it without consuming a byte, to `f->set`.
+ * 
+ * @param  f       The filter.
+ * @param  n       The number of elements in `f->set`,
+ *                 will be updated.
+ * @param  node    The node.
+ * @param  at_bol  Whether at the beginning of the line.
+ * @param  at_eol  Whether at the end of the line.
+ */
+static void
+add_closure(struct filter *f, size_t *n, uint32_t node, int at_bol, int at_eol)
+{
+	size_t sp = 0;
+	struct node *nd;
+
+	f->stack[sp++] = node;
+	while (sp) {
+		node = f->stack[--sp];
+		if (f->marks[node] == f->generation)
+			continue;
+		f->marks[node] = f->generation;
+		nd = &f->nodes[node];
+		switch (nd->type) {
+		case NODE_SPLIT:
+			f->stack[sp++] = nd->out1;
+			/* fall through */
+		case NODE_JUMP:
+			f->stack[sp++] = nd->out;
+			break;
+		case NODE_BOL:
+			if (at_bol)
+				f->stack[sp++] = nd->out;
+			break;
+		case NODE_EOL:
+			if (at_eol) {
+				f->stack[sp++] = nd->out;
+				break;
+			}
+			/* fall through */
+		default:
+			f->set[(*n)++] = node;
+			break;
+		}
+	}
+}
+
+
+/**
+ * Start a new set of NFA nodes in `f->set`.
+ * 
+ * @param  f  The filter.
+ */
+static void
+new_set(struct filter *f)
+{
+	if (!++f->generation) {
+		memset(f->marks, 0, f->node_count * sizeof(*f->marks));
+		f->generation = 1;
+	}
+}
+
+
+/**
+ * Compare two node indices for `qsort`.
+ * 
+ * @param   a  One of the indices.
+ * @param   b  The other index.
+ * @return     Negative if `a` is less than `b`, positive
+ *             if `a` is greater than `b`, 0 otherwise.
+ */
+static int
+compare_nodes(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Get the DFA state for the set of NFA nodes in
+ * `f->set`, constructing it if it does not exist.
+ * 
+ * @param   f  The filter.
+ * @param   n  The number of elements in `f->set`.
+ * @return     The index of the state, -1 on error.
+ */
+static int32_t
+get_state(struct filter *f, size_t n)
+{
+	struct dfa_state *s;
+	size_t i;
+
+	qsort(f->set, n, sizeof(*f->set), compare_nodes);
+	for (i = 0; i < f->state_count; i++)
+		if (f->states[i].node_count == n && !memcmp(f->states[i].nodes, f->set, n * sizeof(*f->set)))
+			return (int32_t)i;
+
+	if (f->state_count == DFA_CACHE_SIZE)
+		flush_states(f);
+	s = &f->states[f->state_count];
+	s->nodes = malloc((n ? n : 1) * sizeof(*s->nodes));
+	if (!s->nodes)
+		return -1;
+	memcpy(s->nodes, f->set, n * sizeof(*f->set));
+	s->node_count = n;
+	for (i = 0; i < 256; i++)
+		s->next[i] = UNKNOWN;
+
+	s->match = s->match_at_eol = 0;
+	for (i = 0; i < n; i++)
+		if (f->nodes[s->nodes[i]].type == NODE_MATCH)
+			s->match = 1;
+
+	/* Check whether the assertions for the end of the line lead
+	 * to a match, in case the line ends in this state. */
+	new_set(f);
+	for (i = 0, n = 0; i < s->node_count; i++)
+		if (f->nodes[s->nodes[i]].type == NODE_EOL)
+			add_closure(f, &n, f->nodes[s->nodes[i]].out, 0, 1);
+	for (i = 0; i < n; i++)
+		if (f->nodes[f->set[i]].type == NODE_MATCH)
+			s->match_at_eol = 1;
+	s->match_at_eol |= s->match;
+
+	return (int32_t)f->state_count++;
+}
+
+
+/**
+ * Get the state a DFA goes to after a byte,
+ * constructing it if it does not exist.
+ * 
+ * As the pattern may match any part of a line, the
+ * state includes starting a new match after the byte.
+ * 
+ * @param   f      The filter.
+ * @param   state  The current state.
+ * @param   c      The byte.
+ * @return         The next state, -1 on error.
+ */
+static int32_t
+step(struct filter *f, int32_t state, unsigned char c)
+{
+	const struct dfa_state *s = &f->states[state];
+	size_t i, n = 0, flushes = f->flushes;
+	struct node *nd;
+	int32_t next;
+
+	new_set(f);
+	for (i = 0; i < s->node_count; i++) {
+		nd = &f->nodes[s->nodes[i]];
+		if (nd->type == NODE_SET && (nd->set[c >> 6] >> (c & 63) & 1))
+			add_closure(f, &n, nd->out, 0, 0);
+	}
+	add_closure(f, &n, f->start, 0, 0);
+
+	next = get_state(f, n);
+	/* The cache may have been flushed, in which case the current
+	 * state is gone, but the next state is still valid. */
+	if (next >= 0 && flushes == f->flushes)
+		f->states[state].next[c] = next;
+	return next;
+}
+
+
+/**
+ * Check whether a line matches a filter's pattern.
+ * 
+ * @param   f    The filter.
+ * @param   s    The line, without the line feed.
+ * @param   len  The length of `s`.
+ * @return       1 if the line matches, 0 if it does not, -1 on error.
+ */
+static int
+line_matches(struct filter *f, const char *s, size_t len)
+{
+	int32_t state = f->start_state, next;
+	size_t n = 0;
+
+	if (state == UNKNOWN) {
+		new_set(f);
+		add_closure(f, &n, f->start, 1, 0);
+		state = f->start_state = get_state(f, n);
+		if (state < 0)
+			return -1;
+	}
+
+	for (; len--; s++) {
+		if (f->states[state].match)
+			return 1;
+		next = f->states[state].next[(unsigned char)*s];
+		if (next == UNKNOWN) {
+			next = step(f, state, (unsigned char)*s);
+			if (next < 0)
+				return -1;
+		}
+		state = next;
+	}
+	return f->states[state].match_at_eol;
+}
+
+
+/**
+ * Remove the lines from the loaded text that
+ * are not selected by the line filters.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+int
+filter_lines(void)
+{
+	char *line, *end, *out, *text_end;
+	size_t i, len;
+	int r, include, have_include = 0;
+
+	if (!filter_count || !text)
+		return 0;
+	for (i = 0; i < filter_count; i++)
+		have_include |= !filters[i].exclude;
+
+	text_end = &text[text_size - 2];
+	for (line = out = text; line < text_end; line = end) {
+		end = memchr(line, '\n', (size_t)(text_end - line));
+		end = end ? &end[1] : text_end;
+		len = (size_t)(end - line) - (end[-1] == '\n');
+
+		include = !have_include;
+		for (i = 0; i < filter_count; i++) {
+			if (filters[i].exclude ? include : !include) {
+				r = line_matches(&filters[i], line, len);
+				if (r < 0)
+					return -1;
+				if (r) {
+					include = !filters[i].exclude;
+					if (!include)
+						break;
+				}
+			}
+		}
+		/* An excluding filter may have been skipped before the
+		 * line was included, so check those again. */
+		for (i = 0; include && have_include && i < filter_count; i++) {
+			if (filters[i].exclude) {
+				r = line_matches(&filters[i], line, len);
+				if (r < 0)
+					return -1;
+				include = !r;
+			}
+		}
+
+		if (include) {
+			memmove(out, line, (size_t)(end - line));
+			out += end - line;
+		}
+	}
+
+	*out++ = '\0';
+	*out++ = '\0';
+	text_size = (size_t)(out - text);
+	return 0;
+}
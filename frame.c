@@ -0,0 +1,631 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The word flags that are displayed with attributes.
+ */
+#define ATTRIBUTE_FLAGS  (WORD_REVERSE_VIDEO | WORD_WATCHED | WORD_INSERTED | WORD_DELETED)
+
+/**
+ * The longest run of spaces considered for erasing
+ * characters; longer runs are always erased with EL.
+ */
+#define MAX_FILL  16
+
+/**
+ * What is known about the cursor position.
+ */
+enum knowledge {
+	/**
+	 * Nothing is known.
+	 */
+	UNKNOWN,
+
+	/**
+	 * The row is known.
+	 */
+	ROW_KNOWN,
+
+	/**
+	 * The row and the column are known.
+	 */
+	POSITION_KNOWN
+};
+
+
+
+/**
+ * The state of the terminal, as far as it is known.
+ */
+struct terminal {
+	/**
+	 * What is known about the cursor position.
+	 */
+	enum knowledge known;
+
+	/**
+	 * The row of the cursor, 0 for the top row.
+	 */
+	size_t row;
+
+	/**
+	 * The column of the cursor, 0 for the leftmost column.
+	 */
+	size_t col;
+
+	/**
+	 * The current graphic rendition, as the word flags
+	 * it displays, a combination of `ATTRIBUTE_FLAGS`.
+	 */
+	int attributes;
+};
+
+
+/**
+ * Control sequences being built.
+ */
+struct sequence {
+	/**
+	 * The bytes of the control sequences.
+	 */
+	char buf[FRAME_OVERHEAD];
+
+	/**
+	 * The number of bytes in `buf`.
+	 */
+	size_t len;
+
+	/**
+	 * Whether bytes did not fit in `buf`.
+	 */
+	int overflow;
+};
+
+
+
+/**
+ * Whether the contents of the screen, and the state
+ * of the terminal, are known from the previous frame.
+ */
+static int screen_known = 0;
+
+/**
+ * The state of the terminal after the previous frame.
+ */
+static struct terminal terminal;
+
+/**
+ * The width of the terminal at the previous frame.
+ */
+static size_t screen_width;
+
+/**
+ * The height of the terminal at the previous frame.
+ */
+static size_t screen_height;
+
+/**
+ * The first column of the displayed word.
+ */
+static size_t shown_start;
+
+/**
+ * The column after the last column of the
+ * displayed word, or the width of the terminal
+ * if the width of the word is not known.
+ */
+static size_t shown_end;
+
+/**
+ * The number of repeats displayed below the word, 0 if none.
+ */
+static size_t shown_repeats;
+
+
+
+/**
+ * Empty control sequences.
+ * 
+ * @param  seq  The control sequences.
+ */
+static void
+clear_sequence(struct sequence *seq)
+{
+	seq->len = 0;
+	seq->overflow = 0;
+}
+
+
+/**
+ * Append bytes to control sequences. Bytes that
+ * do not fit are left out, and `seq->overflow`
+ * is set, as the sequences are then broken.
+ * 
+ * @param  seq  The control sequences.
+ * @param  s    The bytes to append.
+ * @param  n    The number of bytes in `s`.
+ */
+static void
+append(struct sequence *seq, const char *s, size_t n)
+{
+	if (n > sizeof(seq->buf) - seq->len) {
+		n = sizeof(seq->buf) - seq->len;
+		seq->overflow = 1;
+	}
+	memcpy(&seq->buf[seq->len], s, n);
+	seq->len += n;
+}
+
+
+/**
+ * Append control sequences to control sequences.
+ * 
+ * @param  seq  The control sequences to append to.
+ * @param  sub  The control sequences to append.
+ */
+static void
+append_sequence(struct sequence *seq, const struct sequence *sub)
+{
+	append(seq, sub->buf, sub->len);
+	seq->overflow |= sub->overflow;
+}
+
+
+/**
+ * Append a control sequence with one numeric parameter,
+ * omitting the parameter if it is 1, which is the default.
+ * 
+ * @param  seq    The control sequences.
+ * @param  n      The parameter.
+ * @param  final  The final byte of the control sequence.
+ */
+static void
+append_csi(struct sequence *seq, size_t n, char final)
+{
+	char buf[3 * sizeof(size_t) + 4];
+	int r = n == 1 ? sprintf(buf, "\033[%c", final) : sprintf(buf, "\033[%zu%c", n, final);
+	append(seq, buf, (size_t)r);
+}
+
+
+/**
+ * Append spaces to control sequences.
+ * 
+ * @param  seq  The control sequences.
+ * @param  n    The number of spaces.
+ */
+static void
+append_spaces(struct sequence *seq, size_t n)
+{
+	while (n--)
+		append(seq, " ", 1);
+}
+
+
+/**
+ * Append the cheapest movement of the cursor in the same
+ * row, to the right with CUF or to the left with BS or CUB.
+ * 
+ * @param  seq   The control sequences.
+ * @param  from  The column of the cursor.
+ * @param  to    The column to move the cursor to.
+ */
+static void
+append_horizontal(struct sequence *seq, size_t from, size_t to)
+{
+	size_t n;
+	if (to > from) {
+		append_csi(seq, to - from, 'C');
+	} else if (to < from) {
+		n = from - to;
+		if (n <= 3)
+			append(seq, "\b\b\b", n);
+		else
+			append_csi(seq, n, 'D');
+	}
+}
+
+
+/**
+ * Move the cursor, with whichever of CUP, CR, and
+ * the relative movements is the cheapest.
+ * 
+ * @param  seq   The control sequences.
+ * @param  term  The state of the terminal, will be updated.
+ * @param  row   The row to move the cursor to.
+ * @param  col   The column to move the cursor to.
+ */
+static void
+move_cursor(struct sequence *seq, struct terminal *term, size_t row, size_t col)
+{
+	struct sequence best, alt;
+	char buf[6 * sizeof(size_t) + 8];
+	int r;
+
+	if (term->known == POSITION_KNOWN && term->row == row && term->col == col)
+		return;
+
+	/* Absolute, omitting the parameters that are 1. */
+	if (!row && !col)
+		r = sprintf(buf, "\033[H");
+	else if (!col)
+		r = sprintf(buf, "\033[%zuH", row + 1);
+	else if (!row)
+		r = sprintf(buf, "\033[;%zuH", col + 1);
+	else
+		r = sprintf(buf, "\033[%zu;%zuH", row + 1, col + 1);
+	clear_sequence(&best);
+	append(&best, buf, (size_t)r);
+
+	if (term->known != UNKNOWN) {
+		/* From the beginning of the line. */
+		clear_sequence(&alt);
+		append(&alt, "\r", 1);
+		if (row != term->row)
+			append_csi(&alt, row > term->row ? row - term->row : term->row - row, row > term->row ? 'B' : 'A');
+		append_horizontal(&alt, 0, col);
+		if (alt.len < best.len)
+			best = alt;
+
+		/* From the cursor. */
+		if (term->known == POSITION_KNOWN) {
+			clear_sequence(&alt);
+			if (row != term->row)
+				append_csi(&alt, row > term->row ? row - term->row : term->row - row, row > term->row ? 'B' : 'A');
+			append_horizontal(&alt, term->col, col);
+			if (alt.len < best.len)
+				best = alt;
+		}
+	}
+
+	append_sequence(seq, &best);
+	term->known = POSITION_KNOWN;
+	term->row = row;
+	term->col = col;
+}
+
+
+/**
+ * Append the SGR parameters that turn on, or off,
+ * the attributes that display word flags.
+ * 
+ * @param  seq    The control sequences.
+ * @param  flags  The word flags, a combination of `ATTRIBUTE_FLAGS`.
+ * @param  on     1 to turn the attributes on, 0 to turn them off.
+ * @param  first  Whether no parameter has been appended yet,
+ *                will be cleared if one is appended.
+ */
+static void
+append_attributes(struct sequence *seq, int flags, int on, int *first)
+{
+	static const struct {
+		int flag;
+		const char *on;
+		const char *off;
+	} attributes[] = {
+		{WORD_REVERSE_VIDEO, "7", "27"},
+		{WORD_WATCHED, "1;31", "22;39"},
+		{WORD_INSERTED, "4", "24"},
+		{WORD_DELETED, "9", "29"}
+	};
+	const char *s;
+	size_t i;
+
+	for (i = 0; i < sizeof(attributes) / sizeof(*attributes); i++) {
+		if (!(flags & attributes[i].flag))
+			continue;
+		if (!*first)
+			append(seq, ";", 1);
+		s = on ? attributes[i].on : attributes[i].off;
+		append(seq, s, strlen(s));
+		*first = 0;
+	}
+}
+
+
+/**
+ * Change the graphic rendition, with whichever is the
+ * cheaper of turning attributes on and off individually,
+ * and resetting all attributes and turning some on.
+ * 
+ * @param  seq   The control sequences.
+ * @param  term  The state of the terminal, will be updated.
+ * @param  want  The word flags to display,
+ *               a combination of `ATTRIBUTE_FLAGS`.
+ */
+static void
+set_attributes(struct sequence *seq, struct terminal *term, int want)
+{
+	struct sequence best, alt;
+	int first;
+
+	if (term->attributes == want)
+		return;
+
+	/* Reset, with an omitted parameter, and turn on. */
+	clear_sequence(&best);
+	append(&best, "\033[", 2);
+	if (want) {
+		append(&best, ";", 1);
+		first = 1;
+		append_attributes(&best, want, 1, &first);
+	}
+	append(&best, "m", 1);
+
+	/* Turn off and on individually. */
+	clear_sequence(&alt);
+	append(&alt, "\033[", 2);
+	first = 1;
+	append_attributes(&alt, term->attributes & ~want, 0, &first);
+	append_attributes(&alt, want & ~term->attributes, 1, &first);
+	append(&alt, "m", 1);
+	if (alt.len < best.len)
+		best = alt;
+
+	append_sequence(seq, &best);
+	term->attributes = want;
+}
+
+
+/**
+ * Erase from the cursor to the end of the line, with
+ * spaces or EL, whichever is cheaper. The default graphic
+ * rendition is selected first, as terminals may fill the
+ * erased characters with the current background.
+ * 
+ * @param  seq   The control sequences.
+ * @param  term  The state of the terminal, will be updated.
+ * @param  n     The number of characters that need
+ *               to be erased, at the cursor.
+ */
+static void
+erase_characters(struct sequence *seq, struct terminal *term, size_t n)
+{
+	set_attributes(seq, term, 0);
+	if (n < 3) {
+		append_spaces(seq, n);
+		term->col += n;
+	} else {
+		append(seq, "\033[K", 3);
+	}
+}
+
+
+/**
+ * Advance the cursor over text written at it.
+ * 
+ * @param  term   The state of the terminal, will be updated.
+ * @param  n      The width of the text, the greatest
+ *                width it may have if not known.
+ * @param  exact  Whether `n` is the exact width of the text.
+ * @param  width  The width of the terminal.
+ * @return        0 if the text fits in the line, -1 if it
+ *                may have wrapped, and the cursor is lost.
+ */
+static int
+advance(struct terminal *term, size_t n, int exact, size_t width)
+{
+	if (term->col + n > width) {
+		term->known = UNKNOWN;
+		return -1;
+	}
+	term->col += n;
+	/* At the right margin the next character wraps,
+	 * and movements from there differ between terminals. */
+	if (!exact || term->col == width)
+		term->known = ROW_KNOWN;
+	return 0;
+}
+
+
+/**
+ * Get the graphic rendition a word is displayed with.
+ * 
+ * @param   i  The index of the word.
+ * @return     The word flags to display,
+ *             a combination of `ATTRIBUTE_FLAGS`.
+ */
+static int
+word_attributes(size_t i)
+{
+	int flags = word_flags[i] & ATTRIBUTE_FLAGS;
+	if (flags & WORD_INSERTED)
+		flags &= ~WORD_DELETED;
+	return flags;
+}
+
+
+/**
+ * Check what the width of a word is known to be.
+ * 
+ * @param   i      The index of the word.
+ * @param   maxp   Output parameter for the greatest
+ *                 width the word may have.
+ * @return         1 if the word is printable ASCII, and its
+ *                 width is `word_widths[i]`, 0 if it is not
+ *                 known exactly, -1 if the word has control
+ *                 characters, such as escape sequences, that
+ *                 leave the state of the terminal unknown.
+ */
+static int
+classify_word(size_t i, size_t *maxp)
+{
+	const unsigned char *s = (const unsigned char *)get_word(i);
+	int exact = 1;
+	size_t max = 0;
+	for (; *s; s++) {
+		if (*s < ' ' || *s == 0x7F) {
+			exact = -1;
+		} else if (*s < 0x80) {
+			max += 1;
+		} else if ((*s & 0xC0) != 0x80) {
+			max += 2;
+			exact = exact < 0 ? -1 : 0;
+		}
+	}
+	*maxp = max;
+	return exact;
+}
+
+
+/**
+ * Format the frame that displays a word, as the least
+ * number of bytes that changes what the previous frame
+ * displayed into what `format_word` would display.
+ * 
+ * The terminal is assumed to interpret the control
+ * functions of ECMA-48 like a VT100 does, and to be
+ * written to only by these frames since the previous
+ * call to `invalidate_frames`. The screen is cleared
+ * whenever its state cannot be known, such as after
+ * a word with control characters, or a resize, and
+ * when the changes need more control sequences than
+ * there is room for.
+ * 
+ * The frame leaves the word's graphic rendition selected.
+ * 
+ * @param   buf      Output buffer for the frame, should have room
+ *                   for the word and `2 * FRAME_OVERHEAD` more bytes;
+ *                   if the frame is truncated, the next frame will
+ *                   clear the screen.
+ * @param   size     The size of `buf`.
+ * @param   i        The index of the word.
+ * @param   width    The width of the terminal.
+ * @param   height   The height of the terminal.
+ * @param   repeats  The number of times to display that the word's
+ *                   line is repeated below the word, 0 for none.
+ * @return           The length of the frame (as `snprintf`),
+ *                   -1 on error (`errno` is set to `EOVERFLOW`
+ *                   if even clearing the screen needs more
+ *                   control sequences than there is room for).
+ */
+int
+encode_frame(char *buf, size_t size, size_t i, size_t width, size_t height, size_t repeats)
+{
+	struct sequence pre, post, alt_pre, alt_post;
+	struct terminal term, alt;
+	size_t row, col, cover, max, rep_row, rep_col, old_len, len;
+	char text[3 * sizeof(size_t) + sizeof("( repeats)")];
+	int exact, want, known, lost, r;
+
+	width = width ? width : 1;
+	height = height ? height : 1;
+	row = (height + 1) / 2 - 1;
+	col = width / 2 > word_anchors[i] ? width / 2 - word_anchors[i] : 0;
+	exact = classify_word(i, &max);
+	cover = exact > 0 ? col + word_widths[i] : col;
+	want = word_attributes(i);
+	repeats = height > 2 ? repeats : 0;
+	rep_row = row + 2 < height ? row + 2 : height - 1;
+	rep_col = width / 2 > 6 ? width / 2 - 7 : 0;
+
+again:
+	old_len = len = 0;
+	known = screen_known && width == screen_width && height == screen_height && exact >= 0;
+	lost = exact < 0 || col + max > width;
+
+	clear_sequence(&pre);
+	clear_sequence(&post);
+	if (known) {
+		term = terminal;
+	} else {
+		/* Start over from a clear screen. */
+		append(&pre, "\033[m\033[2J", 7);
+		memset(&term, 0, sizeof(term));
+		term.known = UNKNOWN;
+		shown_repeats = 0;
+	}
+
+	/* Display, or erase, the number of repeats. */
+	if (repeats != shown_repeats) {
+		if (shown_repeats)
+			old_len = (size_t)sprintf(text, "(%zu repeats)", shown_repeats);
+		set_attributes(&pre, &term, 0);
+		move_cursor(&pre, &term, rep_row, rep_col);
+		if (repeats) {
+			len = (size_t)sprintf(text, "(%zu repeats)", repeats);
+			append(&pre, text, len);
+			lost |= advance(&term, len, 1, width);
+		}
+		if (old_len > len && term.known == POSITION_KNOWN)
+			erase_characters(&pre, &term, old_len - len);
+	}
+
+	if (!known || (shown_start >= col && shown_end <= cover)) {
+		/* Nothing of the previous word remains. */
+		move_cursor(&pre, &term, row, col);
+		set_attributes(&pre, &term, want);
+		advance(&term, max, exact > 0, width);
+		goto out;
+	}
+
+	/* Erase the previous word first... */
+	alt = term;
+	alt_pre = pre;
+	alt_post = post;
+	move_cursor(&alt_pre, &alt, row, col < shown_start ? col : shown_start);
+	erase_characters(&alt_pre, &alt, shown_end - alt.col);
+	move_cursor(&alt_pre, &alt, row, col);
+	set_attributes(&alt_pre, &alt, want);
+	advance(&alt, max, exact > 0, width);
+
+	/* ...or overwrite it, with spaces before the word and
+	 * erasing after it, if the word's width is known. */
+	if (exact > 0 && (shown_start >= col || col - shown_start <= MAX_FILL)) {
+		if (shown_start < col) {
+			move_cursor(&pre, &term, row, shown_start);
+			set_attributes(&pre, &term, 0);
+			append_spaces(&pre, col - shown_start);
+			term.col = col;
+		} else {
+			move_cursor(&pre, &term, row, col);
+		}
+		set_attributes(&pre, &term, want);
+		advance(&term, max, 1, width);
+		if (shown_end > cover)
+			erase_characters(&post, &term, shown_end - cover);
+		if (pre.len + post.len <= alt_pre.len + alt_post.len)
+			goto out;
+	}
+	pre = alt_pre;
+	post = alt_post;
+	term = alt;
+
+out:
+	if (pre.overflow || post.overflow) {
+		/* Truncated control sequences would leave the screen
+		 * in disarray, so start over from a clear screen. */
+		screen_known = 0;
+		if (!known)
+			return errno = EOVERFLOW, -1;
+		goto again;
+	}
+
+	/* Remember the frame, unless the screen may now differ. */
+	terminal = term;
+	screen_known = !lost;
+	screen_width = width;
+	screen_height = height;
+	shown_start = col;
+	shown_end = exact > 0 ? cover : width;
+	shown_repeats = repeats;
+
+	r = snprintf(buf, size, "%.*s%s%.*s", (int)pre.len, pre.buf, get_word(i), (int)post.len, post.buf);
+	if (r < 0 || (size_t)r >= size)
+		screen_known = 0;
+	return r;
+}
+
+
+/**
+ * Make the next frame clear the screen and display
+ * the word anew, as the screen may have been written
+ * to by something else than `encode_frame`.
+ */
+void
+invalidate_frames(void)
+{
+	screen_known = 0;
+}
@@ -0,0 +1,876 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+#include <dirent.h>
+#include <inttypes.h>
+
+
+
+/**
+ * The magic number at the beginning of an index file.
+ */
+#define INDEX_MAGIC  "RQINDEX3"
+
+/**
+ * The default maximum total size, in megabytes,
+ * of the index files in the cache directory.
+ */
+#ifndef DEFAULT_CACHE_SIZE
+# define DEFAULT_CACHE_SIZE  4096
+#endif
+
+
+
+/**
+ * The header of an index file. The header is followed
+ * by the text and then, each aligned to 8 bytes, the
+ * word offsets, widths, anchors, and flags.
+ */
+struct index_header {
+	/**
+	 * `INDEX_MAGIC`.
+	 */
+	char magic[8];
+
+	/**
+	 * `sizeof(size_t)` for the process that built the index.
+	 */
+	uint64_t size_t_size;
+
+	/**
+	 * The device the indexed file is stored on.
+	 */
+	uint64_t dev;
+
+	/**
+	 * The inode number of the indexed file.
+	 */
+	uint64_t ino;
+
+	/**
+	 * The size of the indexed file.
+	 */
+	uint64_t size;
+
+	/**
+	 * The seconds part of the indexed file's modification time.
+	 */
+	int64_t mtime_sec;
+
+	/**
+	 * The nanoseconds part of the indexed file's modification time.
+	 */
+	int64_t mtime_nsec;
+
+	/**
+	 * The number of words.
+	 */
+	uint64_t word_count;
+
+	/**
+	 * The number of bytes in the text.
+	 */
+	uint64_t text_size;
+};
+
+/**
+ * The layout of an index file.
+ */
+struct index_layout {
+	/**
+	 * The offset of the word offsets.
+	 */
+	size_t offsets;
+
+	/**
+	 * The offset of the word widths.
+	 */
+	size_t widths;
+
+	/**
+	 * The offset of the word anchors.
+	 */
+	size_t anchors;
+
+	/**
+	 * The offset of the word flags.
+	 */
+	size_t flags;
+
+	/**
+	 * The size of the file.
+	 */
+	size_t size;
+};
+
+
+
+/**
+ * The mapped index file, `NULL` if the words
+ * were not loaded from an index file.
+ */
+static void *index_map = NULL;
+
+/**
+ * The size of `index_map`.
+ */
+static size_t index_map_size = 0;
+
+
+
+/**
+ * A file in the cache directory.
+ */
+struct cache_entry {
+	/**
+	 * The name of the file.
+	 */
+	char name[64];
+
+	/**
+	 * The size of the file.
+	 */
+	off_t size;
+
+	/**
+	 * The last time the file was used.
+	 */
+	struct timespec used;
+};
+
+
+
+/**
+ * Round up to a multiple of 8.
+ * 
+ * @param   n  The value to round.
+ * @return     `n` rounded up to a multiple of 8.
+ */
+static size_t
+align8(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
+
+/**
+ * Get the layout of an index file.
+ * 
+ * @param  layout  Output parameter for the layout.
+ * @param  words   The number of words.
+ * @param  size    The number of bytes in the text.
+ */
+static void
+get_layout(struct index_layout *layout, size_t words, size_t size)
+{
+	layout->offsets = align8(sizeof(struct index_header) + size);
+	layout->widths = align8(layout->offsets + words * sizeof(*word_offsets));
+	layout->anchors = align8(layout->widths + words * sizeof(*word_widths));
+	layout->flags = align8(layout->anchors + words * sizeof(*word_anchors));
+	layout->size = layout->flags + words * sizeof(*word_flags);
+}
+
+
+/**
+ * Get the pathname of the index file for a file, and
+ * optionally create the directory it shall be stored in.
+ * The directory is $READ_QUICKLY_CACHE, or if not set,
+ * $XDG_CACHE_HOME/read-quickly or ~/.cache/read-quickly.
+ * 
+ * @param   st      The status of the file.
+ * @param   buf     Output buffer for the pathname.
+ * @param   size    The size of `buf`.
+ * @param   create  Whether to create the directory.
+ * @return          0 on success, -1 if no index can be used.
+ */
+static int
+get_index_path(const struct stat *st, char *buf, size_t size, int create)
+{
+	const char *dir, *home;
+	size_t len;
+	int r;
+
+	dir = getenv("READ_QUICKLY_CACHE");
+	if (dir && *dir) {
+		r = snprintf(buf, size, "%s", dir);
+	} else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+		r = snprintf(buf, size, "%s/read-quickly", dir);
+	} else if ((home = getenv("HOME")) && *home) {
+		r = snprintf(buf, size, "%s/.cache", home);
+		if (r < 0 || (size_t)r >= size)
+			return -1;
+		if (create && mkdir(buf, 0700) && errno != EEXIST)
+			return -1;
+		r = snprintf(buf, size, "%s/.cache/read-quickly", home);
+	} else {
+		return -1;
+	}
+	if (r < 0 || (size_t)r >= size)
+		return -1;
+	if (create && mkdir(buf, 0700) && errno != EEXIST)
+		return -1;
+
+	len = (size_t)r;
+	r = snprintf(&buf[len], size - len, "/%jx-%jx",
+	             (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+	if (r < 0 || (size_t)r >= size - len)
+		return -1;
+	return 0;
+}
+
+
+/**
+ * Check whether an index file header is valid for a file.
+ * 
+ * @param   header  The header.
+ * @param   st      The status of the indexed file.
+ * @return          1 if valid, 0 otherwise.
+ */
+static int
+header_matches(const struct index_header *header, const struct stat *st)
+{
+	return !memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) &&
+	       header->size_t_size == sizeof(size_t) &&
+	       header->dev == (uint64_t)st->st_dev &&
+	       header->ino == (uint64_t)st->st_ino &&
+	       header->size == (uint64_t)st->st_size &&
+	       header->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+	       header->mtime_nsec == (int64_t)st->st_mtim.tv_nsec &&
+	       header->word_count <= SIZE_MAX / sizeof(size_t) &&
+	       header->text_size <= SIZE_MAX / 2;
+}
+
+
+/**
+ * Check whether the name of a file in the
+ * cache directory is the name of an index file.
+ * 
+ * @param   name  The name of the file.
+ * @return        1 if it is an index file, 0 otherwise.
+ */
+static int
+is_index_name(const char *name)
+{
+	size_t n = strspn(name, "0123456789abcdef");
+	if (!n || name[n] != '-')
+		return 0;
+	name = &name[n + 1];
+	n = strspn(name, "0123456789abcdef");
+	return n && !name[n];
+}
+
+
+/**
+ * Get the maximum total size of the index files in
+ * the cache directory by reading the environment
+ * variable READ_QUICKLY_CACHE_SIZE, in megabytes.
+ * 
+ * @return  The maximum size in bytes, 0 for no limit.
+ */
+static uintmax_t
+get_cache_limit(void)
+{
+	const char *s = getenv("READ_QUICKLY_CACHE_SIZE");
+	uintmax_t r = DEFAULT_CACHE_SIZE;
+	char *end;
+	if (s && isdigit(*s)) {
+		errno = 0;
+		r = strtoumax(s, &end, 10);
+		if (errno || *end)
+			r = DEFAULT_CACHE_SIZE;
+	}
+	return r > UINTMAX_MAX >> 20 ? 0 : r << 20;
+}
+
+
+/**
+ * Compare two files in the cache directory for `qsort`,
+ * so that the least recently used is sorted first.
+ * 
+ * @param   a  One of the files.
+ * @param   b  The other file.
+ * @return     Negative if `a` was used before `b`, positive
+ *             if `a` was used after `b`, 0 otherwise.
+ */
+static int
+compare_cache_entries(const void *a, const void *b)
+{
+	const struct timespec *x = &((const struct cache_entry *)a)->used;
+	const struct timespec *y = &((const struct cache_entry *)b)->used;
+	if (x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+
+/**
+ * Remove the least recently used index files from
+ * the cache directory, until their total size is
+ * within READ_QUICKLY_CACHE_SIZE, and remove lock
+ * files that are not in use. Errors are ignored.
+ * 
+ * @param  path  The pathname of a file in the cache directory.
+ */
+static void
+trim_cache(const char *path)
+{
+	char dir_path[PATH_MAX];
+	struct cache_entry *entries = NULL;
+	size_t n = 0, capacity = 0, len;
+	uintmax_t limit = get_cache_limit(), total = 0;
+	struct dirent *f;
+	struct stat st;
+	DIR *dir;
+	void *new;
+	int fd;
+
+	len = (size_t)(strrchr(path, '/') - path);
+	memcpy(dir_path, path, len);
+	dir_path[len] = '\0';
+	dir = opendir(dir_path);
+	if (!dir)
+		return;
+
+	while ((f = readdir(dir))) {
+		len = strlen(f->d_name);
+		if (len > 5 && !strcmp(&f->d_name[len - 5], ".lock")) {
+			/* Lock files that no process has
+			 * locked are removed (see lock_index). */
+			fd = openat(dirfd(dir), f->d_name, O_RDWR | O_NOFOLLOW);
+			if (fd >= 0 && !flock(fd, LOCK_EX | LOCK_NB))
+				unlinkat(dirfd(dir), f->d_name, 0);
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+		if (!limit || len >= sizeof(entries->name) || !is_index_name(f->d_name))
+			continue;
+		if (fstatat(dirfd(dir), f->d_name, &st, AT_SYMLINK_NOFOLLOW) || !S_ISREG(st.st_mode))
+			continue;
+		if (n == capacity) {
+			capacity = capacity ? capacity << 1 : 64;
+			new = realloc(entries, capacity * sizeof(*entries));
+			if (!new)
+				goto out;
+			entries = new;
+		}
+		memcpy(entries[n].name, f->d_name, len + 1);
+		entries[n].size = st.st_size;
+		entries[n].used = st.st_atim;
+		if (compare_cache_entries(&(struct cache_entry){.used = st.st_mtim}, &entries[n]) > 0)
+			entries[n].used = st.st_mtim;
+		total += (uintmax_t)st.st_size;
+		n++;
+	}
+
+	if (limit && total > limit) {
+		qsort(entries, n, sizeof(*entries), compare_cache_entries);
+		for (len = 0; len < n && total > limit; len++)
+			if (!unlinkat(dirfd(dir), entries[len].name, 0))
+				total -= (uintmax_t)entries[len].size;
+	}
+
+out:
+	free(entries);
+	closedir(dir);
+}
+
+
+/**
+ * Lock an index file, so that only one process builds it.
+ * 
+ * @param   path  The pathname of the lock file.
+ * @return        A file descriptor to the locked
+ *                lock file, -1 on error.
+ */
+static int
+lock_index(const char *path)
+{
+	struct stat fd_st, path_st;
+	int fd;
+
+	for (;;) {
+		fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+		if (fd < 0)
+			return -1;
+		while (flock(fd, LOCK_EX) && errno == EINTR);
+		/* The lock file is removed when it is unlocked, so
+		 * it may have been removed while we were waiting. */
+		if (!fstat(fd, &fd_st) && !stat(path, &path_st) &&
+		    fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+
+/**
+ * Unlock, and remove, a lock file locked with `lock_index`.
+ * 
+ * @param  path  The pathname of the lock file.
+ * @param  fd    The file descriptor to the lock file, -1 if none.
+ */
+static void
+unlock_index(const char *path, int fd)
+{
+	if (fd < 0)
+		return;
+	unlink(path);
+	close(fd);
+}
+
+
+/**
+ * Open an index file, and check that it is valid.
+ * 
+ * @param   path     The pathname of the index file.
+ * @param   st       The status of the indexed file.
+ * @param   headerp  Output parameter for the header.
+ * @param   layoutp  Output parameter for the layout.
+ * @return           A file descriptor to the index file, -1
+ *                   if the index file does not exist, is
+ *                   invalid or stale, or on error.
+ */
+static int
+open_index(const char *path, const struct stat *st, struct index_header *headerp, struct index_layout *layoutp)
+{
+	struct stat index_st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &index_st))
+		goto fail;
+	/* Do not trust index files that someone else could have written. */
+	if (!S_ISREG(index_st.st_mode) || index_st.st_uid != geteuid() || (index_st.st_mode & 022))
+		goto fail;
+	if (pread(fd, headerp, sizeof(*headerp), 0) != (ssize_t)sizeof(*headerp))
+		goto fail;
+	if (!header_matches(headerp, st))
+		goto fail;
+	/* The text and the words must fit in the index file,
+	 * otherwise the layout could overflow. */
+	if (headerp->text_size > (uintmax_t)index_st.st_size ||
+	    headerp->word_count > ((uintmax_t)index_st.st_size - headerp->text_size) /
+	                          (sizeof(*word_offsets) + sizeof(*word_widths) +
+	                           sizeof(*word_anchors) + sizeof(*word_flags)))
+		goto fail;
+	get_layout(layoutp, (size_t)headerp->word_count, (size_t)headerp->text_size);
+	if ((uintmax_t)index_st.st_size != (uintmax_t)layoutp->size)
+		goto fail;
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+
+/**
+ * Record that an index file has been used, so that
+ * it is not the first to be removed from the cache
+ * directory, even on file systems mounted with
+ * `noatime`. Errors are ignored.
+ * 
+ * @param  fd  The file descriptor to the index file.
+ */
+static void
+mark_used(int fd)
+{
+	struct timespec times[2];
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_NOW;
+	times[1].tv_sec = 0;
+	times[1].tv_nsec = UTIME_OMIT;
+	futimens(fd, times);
+}
+
+
+/**
+ * Check that the words in a mapped index file are
+ * within its text, so that a corrupt index file is
+ * not used. The text shall end with two NUL bytes,
+ * like text loaded with `load_file`, and every word
+ * shall begin within it.
+ * 
+ * @param   map     The mapped index file.
+ * @param   header  The header of the index file.
+ * @param   layout  The layout of the index file.
+ * @return          1 if valid, 0 otherwise.
+ */
+static int
+words_are_valid(const char *map, const struct index_header *header, const struct index_layout *layout)
+{
+	const char *mapped_text = &map[sizeof(*header)];
+	const size_t *offsets = (const void *)&map[layout->offsets];
+	size_t i, n = (size_t)header->word_count, size = (size_t)header->text_size;
+
+	if (!size)
+		return !n;
+	if (size < 2 || mapped_text[size - 2] || mapped_text[size - 1])
+		return 0;
+	for (i = 0; i < n; i++)
+		if (offsets[i] >= size)
+			return 0;
+	return 1;
+}
+
+
+/**
+ * Map an index file, and if it is valid,
+ * use it instead of the loaded words.
+ * 
+ * @param   path  The pathname of the index file.
+ * @param   st    The status of the indexed file.
+ * @return        0 on success, -1 if the index file
+ *                does not exist, is invalid or stale,
+ *                or on error.
+ */
+static int
+attach_index(const char *path, const struct stat *st)
+{
+	struct index_header header;
+	struct index_layout layout;
+	void *map;
+	int fd;
+
+	fd = open_index(path, st, &header, &layout);
+	if (fd < 0)
+		return -1;
+	map = mmap(NULL, layout.size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (!words_are_valid(map, &header, &layout)) {
+		munmap(map, layout.size);
+		close(fd);
+		return -1;
+	}
+	mark_used(fd);
+	close(fd);
+	advise_huge_pages(map, layout.size);
+
+	free_words();
+	index_map = map;
+	index_map_size = layout.size;
+	text = &((char *)map)[sizeof(header)];
+	text_size = (size_t)header.text_size;
+	word_count = word_capacity = (size_t)header.word_count;
+	word_offsets = (void *)&((char *)map)[layout.offsets];
+	word_widths = (void *)&((char *)map)[layout.widths];
+	word_anchors = (void *)&((char *)map)[layout.anchors];
+	word_flags = (void *)&((char *)map)[layout.flags];
+	return 0;
+}
+
+
+/**
+ * Write to a file.
+ * 
+ * @param   fd    The file descriptor.
+ * @param   buf   The data to write.
+ * @param   size  The number of bytes to write.
+ * @return        0 on success, -1 on error.
+ */
+static int
+write_all(int fd, const void *buf, size_t size)
+{
+	const char *s = buf;
+	ssize_t n;
+	while (size) {
+		n = write(fd, s, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		s += n;
+		size -= (size_t)n;
+	}
+	return 0;
+}
+
+
+/**
+ * Write the loaded words to an index file.
+ * 
+ * The file is written under a temporary name and then
+ * renamed, so processes that have mapped an old index
+ * file are not affected. Only the user can read it,
+ * as it contains the text of the file.
+ * 
+ * @param   path  The pathname of the index file.
+ * @param   st    The status of the indexed file.
+ * @return        0 on success, -1 on error.
+ */
+static int
+save_index(const char *path, const struct stat *st)
+{
+	static const char zeroes[8];
+	struct index_header header;
+	struct index_layout layout;
+	char tmp[PATH_MAX];
+	size_t pos;
+	int fd, saved_errno;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.size_t_size = sizeof(size_t);
+	header.dev = (uint64_t)st->st_dev;
+	header.ino = (uint64_t)st->st_ino;
+	header.size = (uint64_t)st->st_size;
+	header.mtime_sec = (int64_t)st->st_mtim.tv_sec;
+	header.mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+	header.word_count = (uint64_t)word_count;
+	header.text_size = (uint64_t)text_size;
+	get_layout(&layout, word_count, text_size);
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return errno = ENAMETOOLONG, -1;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -1;
+
+#define WRITE_AT(OFFSET, DATA, SIZE)\
+	(write_all(fd, zeroes, (OFFSET) - pos) || write_all(fd, (DATA), (SIZE)) ||\
+	 ((pos = (OFFSET) + (SIZE)), 0))
+
+	pos = 0;
+	if (WRITE_AT(0, &header, sizeof(header)) ||
+	    WRITE_AT(sizeof(header), text, text_size) ||
+	    WRITE_AT(layout.offsets, word_offsets, word_count * sizeof(*word_offsets)) ||
+	    WRITE_AT(layout.widths, word_widths, word_count * sizeof(*word_widths)) ||
+	    WRITE_AT(layout.anchors, word_anchors, word_count * sizeof(*word_anchors)) ||
+	    WRITE_AT(layout.flags, word_flags, word_count * sizeof(*word_flags)))
+		goto fail;
+
+#undef WRITE_AT
+
+	if (close(fd)) {
+		fd = -1;
+		goto fail;
+	}
+	if (rename(tmp, path)) {
+		fd = -1;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	saved_errno = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Load a file, using a shared index file if possible.
+ * 
+ * If the file is a regular file, its words are loaded from
+ * an index file in the cache directory which is mapped
+ * read-only and shared with other processes reading the
+ * same file. If there is no up to date index file, the
+ * file is loaded normally, and if `create` is set, an
+ * index file is created.
+ * 
+ * @param   fd      The file descriptor to the file.
+ * @param   create  Whether to create the index file
+ *                  if there is no up to date one.
+ * @return          0 on success, -1 on error.
+ */
+int
+load_indexed_file(int fd, int create)
+{
+	char path[PATH_MAX], lock_path[PATH_MAX + sizeof(".lock")];
+	struct stat st;
+	int lock_fd;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		return load_file(fd);
+	if (get_index_path(&st, path, sizeof(path), create))
+		return load_file(fd);
+	if (!attach_index(path, &st))
+		return 0;
+	if (!create)
+		return load_file(fd);
+
+	/* Only one process shall build the index file,
+	 * the others wait for it and then use it. */
+	sprintf(lock_path, "%s.lock", path);
+	lock_fd = lock_index(lock_path);
+	if (lock_fd >= 0 && !attach_index(path, &st)) {
+		unlock_index(lock_path, lock_fd);
+		return 0;
+	}
+
+	if (load_file(fd))
+		goto fail;
+
+	/* Replace the private copy with the shared index file. */
+	if (!save_index(path, &st)) {
+		attach_index(path, &st);
+		unlock_index(lock_path, lock_fd);
+		trim_cache(path);
+		return 0;
+	}
+
+	unlock_index(lock_path, lock_fd);
+	return 0;
+
+fail:
+	unlock_index(lock_path, lock_fd);
+	return -1;
+}
+
+
+/**
+ * Create the index file for a file, unless
+ * it already has an up to date index file.
+ * The words are not kept loaded, and the cache
+ * directory is not trimmed (see `trim_index_cache`).
+ * 
+ * @param   fd  The file descriptor to the file.
+ * @return      1 if the index file was up to date,
+ *              0 if it was created, -1 on error (`errno`
+ *              is set to `EINVAL` if the file is not a
+ *              regular file, or if no index can be used).
+ */
+int
+build_index(int fd)
+{
+	char path[PATH_MAX], lock_path[PATH_MAX + sizeof(".lock")];
+	struct index_header header;
+	struct index_layout layout;
+	struct stat st;
+	int index_fd, lock_fd, r = 1, saved_errno;
+
+	if (fstat(fd, &st))
+		return -1;
+	if (!S_ISREG(st.st_mode) || get_index_path(&st, path, sizeof(path), 1))
+		return errno = EINVAL, -1;
+
+	index_fd = open_index(path, &st, &header, &layout);
+	if (index_fd >= 0)
+		return close(index_fd), 1;
+
+	/* Do not race with other processes building the same index file. */
+	sprintf(lock_path, "%s.lock", path);
+	lock_fd = lock_index(lock_path);
+
+	index_fd = open_index(path, &st, &header, &layout);
+	if (index_fd >= 0) {
+		close(index_fd);
+	} else {
+		r = (load_file(fd) || save_index(path, &st)) ? -1 : 0;
+		saved_errno = errno;
+		load_file(-1);
+		errno = saved_errno;
+	}
+
+	unlock_index(lock_path, lock_fd);
+	return r;
+}
+
+
+/**
+ * Get the status of the cache directory.
+ * 
+ * @param   st  Output parameter for the status.
+ * @return      0 on success, -1 if there is no cache directory.
+ */
+int
+stat_index_cache(struct stat *st)
+{
+	char path[PATH_MAX];
+	memset(st, 0, sizeof(*st));
+	if (get_index_path(st, path, sizeof(path), 0))
+		return -1;
+	*strrchr(path, '/') = '\0';
+	return stat(path, st);
+}
+
+
+/**
+ * Check whether a file is an index file, or a lock file
+ * or an unfinished index file, so it is not indexed.
+ * 
+ * @param   path  The pathname of the file.
+ * @return        1 if it is, 0 otherwise.
+ */
+int
+is_index_file(const char *path)
+{
+	char name[64], magic[sizeof(INDEX_MAGIC) - 1];
+	const char *base = strrchr(path, '/');
+	size_t len;
+	ssize_t n;
+	int fd;
+
+	base = base ? &base[1] : path;
+	len = strcspn(base, ".");
+	if (base[len] && len < sizeof(name)) {
+		memcpy(name, base, len);
+		name[len] = '\0';
+		if (is_index_name(name) && (!strcmp(&base[len], ".lock") || strlen(&base[len]) == sizeof(".XXXXXX") - 1))
+			return 1;
+	}
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+	n = pread(fd, magic, sizeof(magic), 0);
+	close(fd);
+	return n == (ssize_t)sizeof(magic) && !memcmp(magic, INDEX_MAGIC, sizeof(magic));
+}
+
+
+/**
+ * Remove the least recently used index files from the
+ * cache directory, until their total size is within
+ * READ_QUICKLY_CACHE_SIZE, and remove unused lock files.
+ */
+void
+trim_index_cache(void)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	if (!get_index_path(&st, path, sizeof(path), 0))
+		trim_cache(path);
+}
+
+
+/**
+ * Get the size of the index file the words were loaded from.
+ * 
+ * @return  The size of the mapped index file, 0 if the
+ *          words were not loaded from an index file.
+ */
+size_t
+index_size(void)
+{
+	return index_map ? index_map_size : 0;
+}
+
+
+/**
+ * Unmap the index file, if the words were loaded from one.
+ * 
+ * @return  1 if the words were loaded from an
+ *          index file, 0 otherwise.
+ */
+int
+release_index(void)
+{
+	if (!index_map)
+		return 0;
+	munmap(index_map, index_map_size);
+	index_map = NULL;
+	index_map_size = 0;
+	return 1;
+}
@@ -0,0 +1,300 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * A run of consecutive identical lines, collapsed
+ * into the first line of the run.
+ */
+struct line_run {
+	/**
+	 * The index of the first word of the first line.
+	 */
+	size_t first;
+
+	/**
+	 * The index of the first word of the second line,
+	 * the first word that is hidden.
+	 */
+	size_t hidden;
+
+	/**
+	 * The index of the word after the last line.
+	 */
+	size_t end;
+
+	/**
+	 * The number of hidden lines.
+	 */
+	size_t repeats;
+
+	/**
+	 * Has the run been expanded, so that
+	 * the hidden lines are displayed?
+	 */
+	int expanded;
+};
+
+
+
+/**
+ * The collapsed runs of lines, in order.
+ */
+static struct line_run *runs = NULL;
+
+/**
+ * The number of elements in `runs`.
+ */
+static size_t run_count = 0;
+
+
+
+/**
+ * Get the index of the first word of the next line.
+ * 
+ * @param   i  The index of a word.
+ * @return     The index of the first word of the line after
+ *             word `i`'s line, `word_count` if none.
+ */
+static size_t
+next_line(size_t i)
+{
+	while (++i < word_count && !(word_flags[i] & WORD_LINE_START));
+	return i;
+}
+
+
+/**
+ * Compare two words.
+ * 
+ * @param   a            One of the words.
+ * @param   b            The other word.
+ * @param   mask_digits  Whether any sequence of digits shall
+ *                       compare equal to any other.
+ * @return               1 if the words are equal, 0 otherwise.
+ */
+static int
+words_equal(const char *a, const char *b, int mask_digits)
+{
+	if (!mask_digits)
+		return !strcmp(a, b);
+	for (;;) {
+		if (isdigit(*a) && isdigit(*b)) {
+			while (isdigit(*a))
+				a++;
+			while (isdigit(*b))
+				b++;
+		} else if (*a != *b) {
+			return 0;
+		} else if (!*a) {
+			return 1;
+		} else {
+			a++;
+			b++;
+		}
+	}
+}
+
+
+/**
+ * Hash a line.
+ * 
+ * @param   first        The index of the line's first word.
+ * @param   end          The index of the first word of the next line.
+ * @param   mask_digits  Whether any sequence of digits shall
+ *                       hash equal to any other.
+ * @return               The hash of the line.
+ */
+static uint64_t
+hash_line(size_t first, size_t end, int mask_digits)
+{
+	uint64_t h = UINT64_C(14695981039346656037);
+	const char *s;
+	size_t i;
+	for (i = first; i < end; i++) {
+		for (s = get_word(i); *s; s++) {
+			if (mask_digits && isdigit(*s)) {
+				while (isdigit(s[1]))
+					s++;
+				h = (h ^ (uint64_t)'0') * UINT64_C(1099511628211);
+			} else {
+				h = (h ^ (uint64_t)(unsigned char)*s) * UINT64_C(1099511628211);
+			}
+		}
+		h = (h ^ (uint64_t)' ') * UINT64_C(1099511628211);
+	}
+	return h;
+}
+
+
+/**
+ * Compare two lines.
+ * 
+ * @param   a            The index of the first word of one of the lines.
+ * @param   a_end        The index of the first word after the line at `a`.
+ * @param   b            The index of the first word of the other line.
+ * @param   b_end        The index of the first word after the line at `b`.
+ * @param   mask_digits  Whether any sequence of digits shall
+ *                       compare equal to any other.
+ * @return               1 if the lines are equal, 0 otherwise.
+ */
+static int
+lines_equal(size_t a, size_t a_end, size_t b, size_t b_end, int mask_digits)
+{
+	if (a_end - a != b_end - b)
+		return 0;
+	for (; a < a_end; a++, b++)
+		if (!words_equal(get_word(a), get_word(b), mask_digits))
+			return 0;
+	return 1;
+}
+
+
+/**
+ * Collapse each run of consecutive identical lines into its
+ * first line. The words of the other lines are kept, so that
+ * the lines can be expanded again.
+ * 
+ * @param   mask_digits  Whether lines that only differ in
+ *                       their digits shall be collapsed.
+ * @return               0 on success, -1 on error.
+ */
+int
+collapse_lines(int mask_digits)
+{
+	size_t line, end, next, next_end = 0, capacity = 0;
+	uint64_t hash, next_hash = 0;
+	void *new;
+
+	free_line_runs();
+	if (!word_count)
+		return 0;
+
+	line = 0;
+	end = next_line(line);
+	hash = hash_line(line, end, mask_digits);
+	while (line < word_count) {
+		for (next = end; next < word_count; next = next_end) {
+			next_end = next_line(next);
+			next_hash = hash_line(next, next_end, mask_digits);
+			if (next_hash != hash || !lines_equal(line, end, next, next_end, mask_digits))
+				break;
+			if (next == end) {
+				if (run_count == capacity) {
+					capacity = capacity ? capacity << 1 : 64;
+					new = realloc(runs, capacity * sizeof(*runs));
+					if (!new)
+						goto fail;
+					runs = new;
+				}
+				runs[run_count].first = line;
+				runs[run_count].hidden = end;
+				runs[run_count].repeats = 0;
+				runs[run_count++].expanded = 0;
+			}
+			runs[run_count - 1].end = next_end;
+			runs[run_count - 1].repeats += 1;
+		}
+		line = next;
+		end = next_end;
+		hash = next_hash;
+	}
+
+	return 0;
+
+fail:
+	free_line_runs();
+	return -1;
+}
+
+
+/**
+ * Deallocate the collapsed runs of lines.
+ */
+void
+free_line_runs(void)
+{
+	free(runs);
+	runs = NULL;
+	run_count = 0;
+}
+
+
+/**
+ * Find the collapsed run of lines a word belongs to.
+ * 
+ * @param   i  The index of the word.
+ * @return     The run, `NULL` if the word is not
+ *             part of a collapsed run.
+ */
+static struct line_run *
+find_run(size_t i)
+{
+	size_t lo = 0, hi = run_count, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (runs[mid].first <= i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo || i >= runs[lo - 1].end || runs[lo - 1].expanded)
+		return NULL;
+	return &runs[lo - 1];
+}
+
+
+/**
+ * Check whether a word is hidden because its
+ * line is a repeat of the previous line.
+ * 
+ * @param   i       The index of the word.
+ * @param   firstp  Output parameter for the index of
+ *                  the first hidden word in the run.
+ * @param   endp    Output parameter for the index of
+ *                  the first word after the run.
+ * @return          1 if the word is hidden, 0 otherwise.
+ */
+int
+line_hidden(size_t i, size_t *firstp, size_t *endp)
+{
+	struct line_run *run = find_run(i);
+	if (!run || i < run->hidden)
+		return 0;
+	*firstp = run->hidden;
+	*endp = run->end;
+	return 1;
+}
+
+
+/**
+ * Get the number of hidden repeats of a word's line.
+ * 
+ * @param   i  The index of the word.
+ * @return     The number of times the line is repeated, and
+ *             hidden, immediately after itself, 0 if none.
+ */
+size_t
+line_repeats(size_t i)
+{
+	struct line_run *run = find_run(i);
+	return (run && i < run->hidden) ? run->repeats : 0;
+}
+
+
+/**
+ * Display the hidden repeats of a word's line.
+ * 
+ * @param   i  The index of the word.
+ * @return     1 if hidden lines were expanded, 0 otherwise.
+ */
+int
+expand_lines(size_t i)
+{
+	struct line_run *run = find_run(i);
+	if (!run)
+		return 0;
+	run->expanded = 1;
+	return 1;
+}
@@ -0,0 +1,172 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * Get a connection to a listening socket.
+ * 
+ * @param   l  The listening socket.
+ * @param   i  The index of the connection.
+ * @return     The connection, which begins with
+ *             the file descriptor of its socket.
+ */
+static int *
+connection(struct listener *l, size_t i)
+{
+	return (void *)&((char *)l->connections)[i * l->connection_size];
+}
+
+
+/**
+ * Create a listening Unix socket. The socket is
+ * created only accessible by the user, as anyone
+ * who can connect to it can use it.
+ * 
+ * @param   l     The listening socket, `connections`,
+ *                `connection_size`, `max_connections`,
+ *                and `release` shall already be set.
+ * @param   path  The pathname of the socket to create.
+ * @return        0 on success, -1 on error.
+ */
+int
+start_listener(struct listener *l, const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t saved_umask;
+	int r, saved_errno;
+
+	l->fd = -1;
+	l->path = NULL;
+	l->count = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return errno = ENAMETOOLONG, -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	l->fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (l->fd < 0)
+		return -1;
+	saved_umask = umask(0077);
+	r = bind(l->fd, (void *)&addr, (socklen_t)sizeof(addr));
+	umask(saved_umask);
+	if (r)
+		goto fail;
+	l->path = path;
+	if (listen(l->fd, SOMAXCONN))
+		goto fail;
+	if (fcntl(l->fd, F_SETFL, O_NONBLOCK))
+		goto fail;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	stop_listener(l);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Close a connection to a listening socket.
+ * The last connection takes its place.
+ * 
+ * @param  l  The listening socket.
+ * @param  i  The index of the connection.
+ */
+void
+drop_connection(struct listener *l, size_t i)
+{
+	int *c = connection(l, i);
+	close(*c);
+	if (l->release)
+		l->release(c);
+	if (i != --l->count)
+		memcpy(c, connection(l, l->count), l->connection_size);
+}
+
+
+/**
+ * Close a listening socket and all connections to it,
+ * and remove the socket.
+ * 
+ * @param  l  The listening socket.
+ */
+void
+stop_listener(struct listener *l)
+{
+	while (l->count)
+		drop_connection(l, l->count - 1);
+	if (l->fd >= 0) {
+		close(l->fd);
+		l->fd = -1;
+	}
+	if (l->path) {
+		unlink(l->path);
+		l->path = NULL;
+	}
+}
+
+
+/**
+ * Add the file descriptors of a listening socket and
+ * its connections to a set of file descriptors to poll.
+ * The connections are polled for input.
+ * 
+ * @param   l    The listening socket.
+ * @param   fds  Output parameter for the file descriptors,
+ *               must have room for `l->max_connections + 1`
+ *               elements.
+ * @return       The number of added file descriptors.
+ */
+size_t
+listener_poll_fds(struct listener *l, struct pollfd *fds)
+{
+	size_t i, n = 0;
+	if (l->fd < 0)
+		return 0;
+	fds[n].fd = l->fd;
+	fds[n].events = l->count < l->max_connections ? POLLIN : 0;
+	fds[n++].revents = 0;
+	for (i = 0; i < l->count; i++) {
+		fds[n].fd = *connection(l, i);
+		fds[n].events = POLLIN;
+		fds[n++].revents = 0;
+	}
+	return n;
+}
+
+
+/**
+ * Accept new connections to a listening socket, if
+ * it has been polled as readable. New connections
+ * are added, zero-initialised but for their sockets,
+ * which are non-blocking, after the old connections.
+ * 
+ * @param   l    The listening socket.
+ * @param   fds  The polled file descriptors, as
+ *               added by `listener_poll_fds`.
+ * @return       The index of the first new connection.
+ */
+size_t
+accept_connections(struct listener *l, const struct pollfd *fds)
+{
+	size_t first = l->count;
+	int fd, *c;
+
+	while ((fds[0].revents & POLLIN) && l->count < l->max_connections) {
+		fd = accept(l->fd, NULL, NULL);
+		if (fd < 0)
+			break;
+		if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			close(fd);
+			continue;
+		}
+		c = connection(l, l->count++);
+		memset(c, 0, l->connection_size);
+		*c = fd;
+	}
+	return first;
+}
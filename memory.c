@@ -0,0 +1,178 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+# include <malloc.h>
+#endif
+
+
+
+/**
+ * The size of a transparent huge page. Allocations of at
+ * least this size are aligned to it, and advised to be
+ * backed by huge pages, so that passes over the words do
+ * not miss in the TLB for every 4 kB page.
+ */
+#ifndef HUGE_PAGE_SIZE
+# define HUGE_PAGE_SIZE  (2UL << 20)
+#endif
+
+/**
+ * The number of bytes each word takes in the word index.
+ */
+#define WORD_INDEX_ENTRY\
+	(sizeof(*word_offsets) + sizeof(*word_widths) + sizeof(*word_anchors) + sizeof(*word_flags))
+
+
+
+/**
+ * Get the number of bytes the allocator has
+ * reserved for an allocation, beyond its size.
+ * 
+ * @param   ptr   The allocation, may be `NULL`.
+ * @param   size  The size of the allocation.
+ * @return        The number of unused bytes, 0 if unknown.
+ */
+static size_t
+slack(void *ptr, size_t size)
+{
+#if defined(__GLIBC__)
+	size_t usable = ptr ? malloc_usable_size(ptr) : 0;
+	return usable > size ? usable - size : 0;
+#else
+	(void) ptr;
+	(void) size;
+	return 0;
+#endif
+}
+
+
+/**
+ * Advise the kernel to back memory with transparent
+ * huge pages, if it supports it. If not, or if the
+ * memory is too small, the memory is left as is.
+ * 
+ * @param  ptr   The memory.
+ * @param  size  The size of the memory.
+ */
+void
+advise_huge_pages(void *ptr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	static long page_size = 0;
+	uintptr_t start, end;
+
+	if (size < HUGE_PAGE_SIZE)
+		return;
+	if (!page_size) {
+		page_size = sysconf(_SC_PAGESIZE);
+		if (page_size <= 0)
+			page_size = 4096;
+	}
+
+	/* The pages that overlap the memory. Pages that are
+	 * shared with other allocations are only flagged. */
+	start = (uintptr_t)ptr & ~((uintptr_t)page_size - 1);
+	end = ((uintptr_t)ptr + size + (uintptr_t)page_size - 1) & ~((uintptr_t)page_size - 1);
+	madvise((void *)start, (size_t)(end - start), MADV_HUGEPAGE);
+#else
+	(void) ptr;
+	(void) size;
+#endif
+}
+
+
+/**
+ * Reallocate memory that may be large, like `realloc`,
+ * but if it is at least `HUGE_PAGE_SIZE` large, also
+ * advise that it is backed by transparent huge pages.
+ * 
+ * When the memory first grows that large it is moved
+ * to memory aligned to `HUGE_PAGE_SIZE`, so that none
+ * of it is left outside a huge page at the beginning;
+ * after that `realloc` is used, to avoid copying.
+ * 
+ * `realloc` moves large allocations with `mremap`, to
+ * addresses not aligned to `HUGE_PAGE_SIZE`, which
+ * splits their huge pages, so memory that is known to
+ * grow large should be allocated at its full size.
+ * 
+ * If transparent huge pages are not supported,
+ * this is just `realloc`.
+ * 
+ * @param   ptr       The memory, may be `NULL`.
+ * @param   old_size  The size of the memory.
+ * @param   size      The new size of the memory.
+ * @return            The reallocated memory,
+ *                    `NULL` on error (`ptr` is not freed).
+ */
+void *
+realloc_large(void *ptr, size_t old_size, size_t size)
+{
+	void *new = NULL;
+
+	if (size >= HUGE_PAGE_SIZE && old_size < HUGE_PAGE_SIZE && !posix_memalign(&new, HUGE_PAGE_SIZE, size)) {
+		if (ptr)
+			memcpy(new, ptr, old_size);
+		free(ptr);
+	} else {
+		/* Not aligned if `posix_memalign` failed. */
+		new = realloc(ptr, size);
+		if (!new)
+			return NULL;
+	}
+
+	if (size > old_size)
+		advise_huge_pages(new, size);
+	return new;
+}
+
+
+/**
+ * Print how much memory the loaded words take,
+ * and the peak resident set size, to stderr.
+ * 
+ * @param  prog  The name of the program.
+ */
+void
+report_memory(const char *prog)
+{
+	struct rusage usage;
+	size_t per_word = WORD_INDEX_ENTRY, map_size = index_size(), index_bytes, extra;
+	double n = word_count ? (double)word_count : 1;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info;
+#endif
+
+	if (!getrusage(RUSAGE_SELF, &usage))
+		fprintf(stderr, "%s: memory: peak resident set size %li kB\n", prog, (long)usage.ru_maxrss);
+
+	if (map_size) {
+		fprintf(stderr, "%s: memory: %zu words mapped from an index file of %zu bytes, %.2f bytes per word\n",
+		        prog, word_count, map_size, (double)map_size / n);
+		return;
+	}
+
+	index_bytes = word_capacity * per_word;
+	fprintf(stderr, "%s: memory: %zu words, word index %zu bytes allocated for %zu words, "
+	                "%.2f bytes per word (%zu used)\n",
+	        prog, word_count, index_bytes, word_capacity, (double)index_bytes / n, per_word);
+	fprintf(stderr, "%s: memory: text %zu bytes retained, %.2f bytes per word\n",
+	        prog, text_size, (double)text_size / n);
+
+	extra = slack(text, text_size);
+	extra += slack(word_offsets, word_capacity * sizeof(*word_offsets));
+	extra += slack(word_widths, word_capacity * sizeof(*word_widths));
+	extra += slack(word_anchors, word_capacity * sizeof(*word_anchors));
+	extra += slack(word_flags, word_capacity * sizeof(*word_flags));
+	fprintf(stderr, "%s: memory: allocator overhead %zu bytes in the text and the word index, "
+	                "plus %zu bytes of unused word index capacity\n",
+	        prog, extra, (word_capacity - word_count) * per_word);
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	info = mallinfo2();
+	fprintf(stderr, "%s: memory: heap %zu bytes allocated (%zu mapped separately), %zu bytes free but held\n",
+	        prog, info.uordblks + info.hblkhd, info.hblkhd, info.fordblks);
+#endif
+}
@@ -0,0 +1,324 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The weight of one intervention in `struct adapter.load`.
+ */
+#define ADAPT_UNIT  1024
+
+/**
+ * The number of words over which the adapter's memory
+ * of an intervention decays to about a third.
+ */
+#ifndef ADAPT_MEMORY
+# define ADAPT_MEMORY  64
+#endif
+
+/**
+ * The weight, in 1/4 interventions, of a pause. A pause
+ * is less likely than a rewind to mean that the reader
+ * cannot keep up, they may just be taking a break.
+ */
+#ifndef ADAPT_PAUSE_WEIGHT
+# define ADAPT_PAUSE_WEIGHT  2
+#endif
+
+/**
+ * The recent interventions, in 1/4 interventions,
+ * above which further interventions slow down the rate.
+ */
+#ifndef ADAPT_CLUSTER
+# define ADAPT_CLUSTER  6
+#endif
+
+/**
+ * The recent interventions, in 1/4 interventions,
+ * below which the rate is gradually increased.
+ */
+#ifndef ADAPT_CALM
+# define ADAPT_CALM  1
+#endif
+
+/**
+ * The rate is divided by this for the amount it is
+ * reduced by for each intervention in a cluster.
+ */
+#ifndef ADAPT_SLOWDOWN
+# define ADAPT_SLOWDOWN  16
+#endif
+
+/**
+ * The rate is divided by this for the amount it is
+ * increased by for each word displayed while calm.
+ */
+#ifndef ADAPT_SPEEDUP
+# define ADAPT_SPEEDUP  4096
+#endif
+
+
+
+/**
+ * Start pacing words.
+ * 
+ * @param  pacer     The pacer to initialise.
+ * @param  rate      The number of words per minute,
+ *                   multiplied by `RATE_SCALE`.
+ * @param  schedule  The rate schedule, `NULL` for a constant
+ *                   rate; must remain valid while the pacer
+ *                   is used.
+ */
+void
+pacer_init(struct pacer *pacer, long rate, const struct schedule *schedule)
+{
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->rate = pacer->current_rate = rate;
+	pacer->schedule = schedule;
+}
+
+
+/**
+ * Change the word rate.
+ * 
+ * @param  pacer  The pacer.
+ * @param  rate   The number of words per minute,
+ *                multiplied by `RATE_SCALE`.
+ */
+void
+pacer_set_rate(struct pacer *pacer, long rate)
+{
+	pacer->rate = rate;
+}
+
+
+/**
+ * Get how far the pacer has come since the ramp started.
+ * 
+ * @param   pacer  The pacer.
+ * @param   unit   The unit to measure in.
+ * @return         The position in the ramp, in `unit`.
+ */
+static long long
+ramp_position(const struct pacer *pacer, enum schedule_unit unit)
+{
+	if (unit == SCHEDULE_WORDS)
+		return pacer->words - pacer->ramp_words;
+	return pacer->elapsed - pacer->ramp_elapsed;
+}
+
+
+/**
+ * Get the rate the next word shall be displayed at.
+ * 
+ * @param   pacer  The pacer.
+ * @return         The number of words per minute,
+ *                 multiplied by `RATE_SCALE`.
+ */
+static long
+scheduled_rate(struct pacer *pacer)
+{
+	const struct schedule *schedule = pacer->schedule;
+	double x;
+	long r;
+
+	if (!schedule)
+		return pacer->rate;
+
+	if (schedule->period && ramp_position(pacer, schedule->period_unit) >= schedule->period) {
+		pacer->ramp_words = pacer->words;
+		pacer->ramp_elapsed = pacer->elapsed;
+	}
+	if (ramp_position(pacer, schedule->length_unit) >= schedule->length)
+		return pacer->rate;
+
+	x = (double)ramp_position(pacer, schedule->length_unit) / (double)schedule->length;
+	if (schedule->curve == RAMP_SMOOTH)
+		x = x * x * (3 - 2 * x);
+	r = schedule->start_rate + (long)((double)(pacer->rate - schedule->start_rate) * x);
+	return r < 1 ? 1 : r;
+}
+
+
+/**
+ * Get the time the next word shall be displayed.
+ * 
+ * The interval cannot in general be expressed exactly
+ * in nanoseconds, so the rounding error is carried over
+ * to the next interval, so that the total time of any
+ * number of words matches the rate exactly.
+ * 
+ * @param   pacer  The pacer.
+ * @return         The number of nanoseconds the word shall be displayed.
+ */
+long long
+pacer_next(struct pacer *pacer)
+{
+	long long n;
+
+	pacer->current_rate = scheduled_rate(pacer);
+	if (pacer->remainder >= pacer->current_rate)
+		pacer->remainder = 0;
+
+	n = 60000000000LL * RATE_SCALE + pacer->remainder;
+	pacer->remainder = n % pacer->current_rate;
+	n /= pacer->current_rate;
+
+	pacer->words += 1;
+	pacer->elapsed += n;
+	return n;
+}
+
+
+/**
+ * Start pacing lines by their timestamps, in addition to
+ * pacing the words at the word rate. See `pacer_line`.
+ * 
+ * @param  pacer   The pacer.
+ * @param  replay  How the lines are paced, `NULL` to stop pacing
+ *                 lines; must remain valid while the pacer is used.
+ */
+void
+pacer_replay(struct pacer *pacer, const struct replay *replay)
+{
+	pacer->replay = replay;
+	pacer->have_line = 0;
+}
+
+
+/**
+ * Get the longest time between two lines.
+ * 
+ * @param   pacer  The pacer.
+ * @return         The longest time, in nanoseconds.
+ */
+static long long
+max_gap(const struct pacer *pacer)
+{
+	long long per_word;
+	if (pacer->replay->max_gap_unit == SCHEDULE_NANOSECONDS)
+		return pacer->replay->max_gap;
+	per_word = 60000000000LL * RATE_SCALE / pacer->current_rate;
+	if (per_word && pacer->replay->max_gap > LLONG_MAX / per_word)
+		return LLONG_MAX;
+	return pacer->replay->max_gap * per_word;
+}
+
+
+/**
+ * Get the time a word shall be displayed, when lines are paced
+ * by their timestamps. The first word of a line with a timestamp
+ * is displayed no earlier than the time the previous line with a
+ * timestamp was displayed plus the difference between their
+ * timestamps, divided by the compression factor and capped, so
+ * that idle periods do not stall the reading. Other words, and
+ * lines that would be displayed later anyway, are not delayed.
+ * 
+ * @param   pacer  The pacer.
+ * @param   i      The index of the word.
+ * @param   t      The time, in nanoseconds, the word would be
+ *                 displayed at if only the words were paced.
+ * @return         The time, in nanoseconds, the word
+ *                 shall be displayed at, no earlier than `t`.
+ */
+long long
+pacer_line(struct pacer *pacer, size_t i, long long t)
+{
+	long long ts, gap, cap, q;
+	long factor;
+
+	if (!pacer->replay || !line_timestamp(i, &ts))
+		return t;
+
+	if (pacer->have_line && ts > pacer->line_time) {
+		factor = pacer->replay->factor;
+		cap = max_gap(pacer);
+		gap = ts - pacer->line_time;
+		q = gap / factor;
+		if (q > cap / RATE_SCALE)
+			gap = cap;
+		else
+			gap = q * RATE_SCALE + gap % factor * RATE_SCALE / factor;
+		gap = gap < cap ? gap : cap;
+		if (pacer->line_deadline > LLONG_MAX - gap)
+			gap = LLONG_MAX - pacer->line_deadline;
+		if (pacer->line_deadline + gap > t)
+			t = pacer->line_deadline + gap;
+	}
+
+	pacer->have_line = 1;
+	pacer->line_time = ts;
+	pacer->line_deadline = t;
+	return t;
+}
+
+
+/**
+ * Start adjusting the word rate.
+ * 
+ * @param  adapter   The adapter to initialise.
+ * @param  min_rate  The lowest rate to slow down to, in words
+ *                   per minute multiplied by `RATE_SCALE`.
+ * @param  max_rate  The highest rate to speed up to, in words
+ *                   per minute multiplied by `RATE_SCALE`.
+ */
+void
+adapter_init(struct adapter *adapter, long min_rate, long max_rate)
+{
+	adapter->min_rate = min_rate;
+	adapter->max_rate = max_rate;
+	adapter->load = 0;
+}
+
+
+/**
+ * Record an intervention by the reader, and slow
+ * down if it is part of a cluster of interventions.
+ * 
+ * @param   adapter  The adapter.
+ * @param   what     The kind of intervention.
+ * @param   rate     The current rate, in words per
+ *                   minute multiplied by `RATE_SCALE`.
+ * @return           The new rate, in words per minute
+ *                   multiplied by `RATE_SCALE`.
+ */
+long
+adapter_intervene(struct adapter *adapter, enum intervention what, long rate)
+{
+	long new_rate;
+
+	if (what == INTERVENTION_PAUSE)
+		adapter->load += ADAPT_UNIT * ADAPT_PAUSE_WEIGHT / 4;
+	else
+		adapter->load += ADAPT_UNIT;
+
+	if (adapter->load <= ADAPT_UNIT * ADAPT_CLUSTER / 4 || rate <= adapter->min_rate)
+		return rate;
+	new_rate = rate - rate / ADAPT_SLOWDOWN;
+	return new_rate < adapter->min_rate ? adapter->min_rate : new_rate;
+}
+
+
+/**
+ * Let the memory of past interventions decay as a word
+ * is displayed, and speed up if the reader has not
+ * intervened for a while.
+ * 
+ * @param   adapter  The adapter.
+ * @param   rate     The current rate, in words per
+ *                   minute multiplied by `RATE_SCALE`.
+ * @return           The new rate, in words per minute
+ *                   multiplied by `RATE_SCALE`.
+ */
+long
+adapter_advance(struct adapter *adapter, long rate)
+{
+	long new_rate;
+
+	adapter->load -= (adapter->load + ADAPT_MEMORY - 1) / ADAPT_MEMORY;
+
+	if (adapter->load >= ADAPT_UNIT * ADAPT_CALM / 4 || rate >= adapter->max_rate)
+		return rate;
+	new_rate = rate + (rate + ADAPT_SPEEDUP - 1) / ADAPT_SPEEDUP;
+	return new_rate > adapter->max_rate ? adapter->max_rate : new_rate;
+}
@@ -1,53 +1,99 @@
 /* See LICENSE file for copyright and license details. */
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-#include <sys/time.h>
-#include <ctype.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <limits.h>
-#include <signal.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <strings.h>
-#include <termios.h>
-#include <unistd.h>
-#include <wchar.h>
+#include "common.h"
 
 
 
 /**
- * The default word rate.
+ * The default word rate, in words per minute.
  */
 #ifndef DEFAULT_RATE
 # define DEFAULT_RATE  120  /* 2 hz */
 #endif
 
 /**
- * Delta-value of rate increment and rate decrement.
+ * Delta-value of rate increment and rate decrement,
+ * in words per minute.
  */
 #ifndef RATE_DELTA
 # define RATE_DELTA  10  /* 10/min */
 #endif
 
+/**
+ * The default length, in words, of the warm-up
+ * ramp when a start rate is selected.
+ */
+#ifndef DEFAULT_RAMP
+# define DEFAULT_RAMP  300
+#endif
 
+/**
+ * The default longest time, in nanoseconds, between
+ * two lines when lines are paced by their timestamps.
+ */
+#ifndef DEFAULT_MAX_GAP
+# define DEFAULT_MAX_GAP  5000000000LL  /* 5 s */
+#endif
 
 /**
- * The a word.
+ * The number of words that are split before the annotators
+ * are run over them. This should be small enough for the
+ * words and their metadata to still be in the L2 cache
+ * when the annotators visit them.
  */
-struct word {
-	/**
-	 * The word.
-	 */
-	const char *word;
+#ifndef ANNOTATION_TILE
+# define ANNOTATION_TILE  4096
+#endif
 
-	/**
-	 * Should reverse video be applied?
-	 */
-	int reverse_video;
-};
+/**
+ * The number of milliseconds to wait before checking
+ * again whether the terminal has caught up with the
+ * output when a frame has been held back.
+ */
+#ifndef BACKLOG_POLL_TIMEOUT
+# define BACKLOG_POLL_TIMEOUT  10
+#endif
+
+/**
+ * The number of microseconds between measurements
+ * of the terminal's round-trip time.
+ */
+#ifndef RTT_PROBE_INTERVAL
+# define RTT_PROBE_INTERVAL  1000000L  /* 1 s */
+#endif
+
+/**
+ * The maximum number of microseconds to wait, when
+ * exiting, for the reply to a round-trip measurement.
+ */
+#ifndef RTT_PROBE_TIMEOUT
+# define RTT_PROBE_TIMEOUT  1000000L  /* 1 s */
+#endif
+
+/**
+ * The maximum number of annotators.
+ */
+#ifndef MAX_ANNOTATORS
+# define MAX_ANNOTATORS  16
+#endif
+
+
+
+/**
+ * A pass that annotates the words as they are loaded.
+ * 
+ * The words are split and annotated in tiles of at most
+ * `ANNOTATION_TILE` words, each annotator is run over
+ * one tile before the next tile is split, so that
+ * all passes are fused into one sweep over the words.
+ * 
+ * @param  first  The index of the first word to annotate.
+ * @param  end    The index of the word after the last word
+ *                to annotate. All words before `first` have
+ *                already been annotated by every annotator,
+ *                and may be looked at, but the words starting
+ *                at `end` have not yet been split.
+ */
+typedef void annotator_func(size_t first, size_t end);
 
 /**
  * The name of the process.
@@ -64,6 +110,13 @@ static volatile sig_atomic_t caught_sigwinch = 1;
  */
 static volatile sig_atomic_t caught_sigalrm = 0;
 
+/**
+ * Pipe that the SIGALRM handler writes a byte to, so
+ * that a timer that expires outside of `poll` still
+ * wakes `read_key` up.
+ */
+static int alarm_pipe[2] = {-1, -1};
+
 /**
  * The width of the terminal.
  */
@@ -77,13 +130,200 @@ static size_t height = 30;
 /**
  * The number of words.
  */
-static size_t word_count = 0;
+size_t word_count = 0;
+
+/**
+ * The number of words there are allocated
+ * space for in the word arrays.
+ */
+size_t word_capacity = 0;
+
+/**
+ * The loaded text, words are NUL-terminated.
+ */
+char *text = NULL;
+
+/**
+ * The number of bytes in `text`.
+ */
+size_t text_size = 0;
+
+/**
+ * The offset in `text` of each word. Refer
+ * to `word_count` for the number of words.
+ * 
+ * The metadata of each word is stored in
+ * separate arrays, rather than in an array
+ * of structures, so that passes over the
+ * words only need to read what they use.
+ */
+size_t *word_offsets = NULL;
+
+/**
+ * The display width of each word, saturated
+ * at `UINT16_MAX`.
+ */
+uint16_t *word_widths = NULL;
+
+/**
+ * The column, within each word, that shall
+ * be placed in the middle of the terminal,
+ * saturated at `UINT8_MAX`.
+ */
+uint8_t *word_anchors = NULL;
+
+/**
+ * Bitwise OR of `enum word_flag` values for each word.
+ */
+uint8_t *word_flags = NULL;
+
+/**
+ * The frame being written to the terminal.
+ */
+static char *frame = NULL;
+
+/**
+ * The allocation size of `frame`.
+ */
+static size_t frame_size = 0;
+
+/**
+ * The length of the frame in `frame`.
+ */
+static size_t frame_len = 0;
+
+/**
+ * The number of bytes in `frame` that
+ * have been written to the terminal.
+ */
+static size_t frame_ptr = 0;
+
+/**
+ * The word that shall be displayed next,
+ * once the terminal has caught up.
+ */
+static size_t pending_word;
+
+/**
+ * Is there a word in `pending_word`?
+ */
+static int have_pending_word = 0;
+
+/**
+ * The file descriptor frames are written to, -1 before
+ * frames are written. If stdout is a terminal, this is
+ * a non-blocking file descriptor of our own to it, so
+ * that stdout, which is shared with other processes,
+ * is not made non-blocking; otherwise it is stdout.
+ */
+static int output_fd = -1;
+
+/**
+ * Should the terminal's round-trip time be measured?
+ */
+static int probe_rtt = 0;
+
+/**
+ * Does the frame in `frame` include a round-trip
+ * time measurement request?
+ */
+static int frame_has_probe = 0;
+
+/**
+ * Has a round-trip time measurement request been
+ * sent without a reply being received yet?
+ */
+static int probe_outstanding = 0;
+
+/**
+ * The time, in microseconds, the last round-trip
+ * time measurement request was sent.
+ */
+static long long probe_sent = 0;
+
+/**
+ * The smoothed round-trip time of the terminal,
+ * in microseconds, 0 if not measured yet.
+ */
+static long long srtt = 0;
+
+/**
+ * The number of microseconds the next word shall be
+ * displayed earlier to compensate for the latest
+ * change in the latency of the terminal.
+ */
+static long long schedule_correction = 0;
+
+/**
+ * The state of the parser for input from the terminal:
+ * 0 for plain input, 1 after an ESC, 2 in a control sequence.
+ */
+static int input_state = 0;
+
+/**
+ * Are words being served to clients?
+ */
+static int serving = 0;
+
+/**
+ * Should the display pause when a word
+ * in the watchlist is displayed?
+ */
+static int pause_on_watch = 0;
+
+/**
+ * Socket connected to the server when attached
+ * to a server as a client, -1 otherwise.
+ */
+static int remote_fd = -1;
+
+/**
+ * Buffer for records received from the server.
+ */
+static char *remote_buf = NULL;
+
+/**
+ * The allocation size of `remote_buf`.
+ */
+static size_t remote_buf_size = 0;
+
+/**
+ * The number of bytes in `remote_buf`.
+ */
+static size_t remote_buf_len = 0;
+
+/**
+ * The argument of the last command returned by `read_key`.
+ */
+static long key_argument = 0;
+
+/**
+ * The annotators to run, in order, over the words.
+ */
+static annotator_func *annotators[MAX_ANNOTATORS];
+
+/**
+ * The number of elements in `annotators`.
+ */
+static size_t annotator_count = 0;
 
 /**
- * All loaded words. Refer to `word_count`
- * for the number of contained words.
+ * The most frequent English function words, in lower case
+ * and sorted, that are skipped when skimming. Words with
+ * punctuation are not skipped, as the punctuation may be
+ * significant, nor are negations.
  */
-static struct word *words;
+static const char function_words[][6] = {
+	"a", "about", "after", "all", "also", "an", "and", "any",
+	"are", "as", "at", "be", "been", "but", "by", "can", "could",
+	"did", "do", "does", "for", "from", "had", "has", "have", "he",
+	"her", "him", "his", "how", "i", "if", "in", "into", "is",
+	"it", "its", "me", "more", "my", "now", "of", "on", "one",
+	"or", "our", "out", "she", "so", "some", "than", "that", "the",
+	"their", "them", "then", "there", "these", "they", "this",
+	"those", "to", "up", "us", "was", "we", "were", "what", "when",
+	"which", "who", "will", "with", "would", "you", "your"
+};
 
 
 
@@ -106,11 +346,47 @@ sigwinch(int signo)
 static void
 sigalrm(int signo)
 {
+	int saved_errno = errno;
 	caught_sigalrm = 1;
+	if (alarm_pipe[1] >= 0)
+		(void) write(alarm_pipe[1], "", 1);
+	errno = saved_errno;
 	(void) signo;
 }
 
 
+/**
+ * Stop waking `read_key` up on SIGALRM, and close
+ * the pipe used for it.
+ */
+static void
+close_alarm_pipe(void)
+{
+	int fd;
+	if (alarm_pipe[0] >= 0) {
+		fd = alarm_pipe[1];
+		alarm_pipe[1] = -1;
+		close(fd);
+		close(alarm_pipe[0]);
+		alarm_pipe[0] = -1;
+	}
+}
+
+
+/**
+ * Get the current time.
+ * 
+ * @return  The time, in microseconds, on the monotonic clock.
+ */
+static long long
+get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + (long long)ts.tv_nsec / 1000LL;
+}
+
+
 /**
  * Get the size of the terminal.
  */
@@ -130,25 +406,37 @@ get_terminal_size(void)
 
 
 /**
- * Get the selected word rate by reading
- * the environment variable READ_QUICKLY_RATE.
+ * Get a selected word rate by reading an environment variable.
  * 
- * @return  The rate in words per minute.
+ * @param   var  The name of the environment variable,
+ *               e.g. "READ_QUICKLY_RATE".
+ * @param   def  The rate to use if the variable is not set
+ *               or is invalid, in words per minute
+ *               multiplied by `RATE_SCALE`.
+ * @return       The rate in words per minute,
+ *               multiplied by `RATE_SCALE`.
  */
 static long
-get_word_rate(void)
+get_word_rate(const char *var, long def)
 {
 	char *s;
-	long r;
+	long r, scale = RATE_SCALE;
 
 	errno = 0;
-	s = getenv("READ_QUICKLY_RATE");
+	s = getenv(var);
 	if (!s || !*s || !isdigit(*s))
-		return DEFAULT_RATE;
+		return def;
 
 	r = strtol(s, &s, 10);
+	if (errno || r < 0 || r > LONG_MAX / RATE_SCALE / 60)
+		return def;
+	r *= RATE_SCALE;
+	if (*s == '.')
+		for (s++; isdigit(*s); s++)
+			if ((scale /= 10))
+				r += (*s - '0') * scale;
 	if (r <= 0)
-		return DEFAULT_RATE;
+		return def;
 	while (*s == ' ')
 		s++;
 
@@ -167,12 +455,166 @@ get_word_rate(void)
 	else if (!strcasecmp(s, "/sec"))   r *= 60;
 	else if (!strcasecmp(s, "hz"))     r *= 60;
 	else
-		return DEFAULT_RATE;
+		return def;
+
+	return r;
+}
+
+
+/**
+ * Get a length of a rate schedule by reading
+ * an environment variable.
+ * 
+ * @param   var    The name of the environment variable.
+ * @param   def    The length, in words, to use if the
+ *                 variable is not set or is invalid.
+ * @param   unitp  Output parameter for the unit of the length.
+ * @return         The length, in `*unitp`.
+ */
+static long long
+get_schedule_length(const char *var, long long def, enum schedule_unit *unitp)
+{
+	char *s;
+	long long r, frac = 0, scale = 1000000000LL;
+
+	*unitp = SCHEDULE_WORDS;
+	errno = 0;
+	s = getenv(var);
+	if (!s || !*s || !isdigit(*s))
+		return def;
+
+	r = strtoll(s, &s, 10);
+	if (errno || r > LLONG_MAX / 60000000000LL)
+		return def;
+	if (*s == '.')
+		for (s++; isdigit(*s); s++)
+			if ((scale /= 10))
+				frac += (*s - '0') * scale;
+	while (*s == ' ')
+		s++;
 
+	if (!*s || !strcasecmp(s, "w") || !strcasecmp(s, "words")) {
+		return r ? r : def;
+	} else if (!strcasecmp(s, "s") || !strcasecmp(s, "sec")) {
+		r = r * 1000000000LL + frac;
+	} else if (!strcasecmp(s, "m") || !strcasecmp(s, "min")) {
+		r = (r * 1000000000LL + frac) * 60;
+	} else {
+		return def;
+	}
+	if (!r)
+		return def;
+	*unitp = SCHEDULE_NANOSECONDS;
 	return r;
 }
 
 
+/**
+ * Get the selected rate schedule by reading the
+ * environment variables READ_QUICKLY_START_RATE,
+ * READ_QUICKLY_RAMP, READ_QUICKLY_RAMP_CURVE,
+ * and READ_QUICKLY_SAWTOOTH.
+ * 
+ * @param   schedule  Output parameter for the schedule.
+ * @return            1 if a schedule was selected, 0 if
+ *                    the rate shall be constant.
+ */
+static int
+get_schedule(struct schedule *schedule)
+{
+	const char *curve;
+
+	schedule->start_rate = get_word_rate("READ_QUICKLY_START_RATE", 0);
+	if (!schedule->start_rate)
+		return 0;
+
+	schedule->length = get_schedule_length("READ_QUICKLY_RAMP", DEFAULT_RAMP, &schedule->length_unit);
+
+	curve = getenv("READ_QUICKLY_RAMP_CURVE");
+	if (curve && !strcasecmp(curve, "smooth"))
+		schedule->curve = RAMP_SMOOTH;
+	else
+		schedule->curve = RAMP_LINEAR;
+
+	schedule->period = get_schedule_length("READ_QUICKLY_SAWTOOTH", 0, &schedule->period_unit);
+	return 1;
+}
+
+
+/**
+ * Get the selected CPU to pin the process to
+ * by reading an environment variable.
+ * 
+ * @param   var  The name of the environment variable,
+ *               e.g. "READ_QUICKLY_CPU".
+ * @return       The number of the CPU, -1 if the variable
+ *               is not set or is invalid.
+ */
+static long
+get_cpu(const char *var)
+{
+	const char *s = getenv(var);
+	char *end;
+	long r;
+	if (!s || !isdigit(*s))
+		return -1;
+	errno = 0;
+	r = strtol(s, &end, 10);
+	return (errno || *end) ? -1 : r;
+}
+
+
+/**
+ * Get the selected compression factor for
+ * pacing lines by their timestamps.
+ * 
+ * @param   s  The factor, with an optional fraction and
+ *             an optional 'x' after it, e.g. "60x".
+ * @return     The factor multiplied by `RATE_SCALE`,
+ *             0 if `s` is invalid.
+ */
+static long
+get_factor(const char *s)
+{
+	long r, scale = RATE_SCALE;
+	char *end;
+
+	errno = 0;
+	if (!isdigit(*s))
+		return 0;
+	r = strtol(s, &end, 10);
+	if (errno || r > LONG_MAX / RATE_SCALE / 1000)
+		return 0;
+	r *= RATE_SCALE;
+	if (*end == '.')
+		for (end++; isdigit(*end); end++)
+			if ((scale /= 10))
+				r += (*end - '0') * scale;
+	if (*end == 'x' || *end == 'X')
+		end++;
+	return *end ? 0 : r;
+}
+
+
+/**
+ * Get the selected pacing of lines by their timestamps
+ * by reading the environment variable READ_QUICKLY_MAX_GAP.
+ * 
+ * @param   replay  Output parameter for the pacing.
+ * @param   factor  The compression factor, multiplied by `RATE_SCALE`.
+ */
+static void
+get_replay(struct replay *replay, long factor)
+{
+	replay->factor = factor;
+	replay->max_gap = get_schedule_length("READ_QUICKLY_MAX_GAP", 0, &replay->max_gap_unit);
+	if (!replay->max_gap) {
+		replay->max_gap = DEFAULT_MAX_GAP;
+		replay->max_gap_unit = SCHEDULE_NANOSECONDS;
+	}
+}
+
+
 /**
  * Count the number of character in a string.
  * 
@@ -199,121 +641,921 @@ display_len(const char *s)
 
 
 /**
- * Load the file and do some preparsing.
+ * Grow the word arrays.
  * 
- * @param   fd  The file descriptor to the file, -1 to clean up instead.
- * @return      0 on success, -1 on error.
+ * @param   size  The number of words to make room for.
+ * @return        0 on success, -1 on error.
  */
 static int
-load_file(int fd)
+grow_words(size_t size)
 {
-	static char *buffer = NULL;
-	size_t ptr = 0;
-	size_t size = 0;
 	void *new;
-	int saved_errno;
-	char *s;
-	char *end;
-	size_t i;
-	ssize_t n;
 
-	if (fd == -1)
-		return free(buffer), 0;
+	new = realloc_large(word_offsets, word_capacity * sizeof(*word_offsets), size * sizeof(*word_offsets));
+	if (!new)
+		return -1;
+	word_offsets = new;
 
-	/* Load file. */
-	for (;;) {
-		if (ptr == size) {
-			size = size ? size << 1 : 8 << 10;
-			new = realloc(buffer, size);
-			if (!new)
-				goto fail;
-			buffer = new;
-		}
-		n = read(fd, buffer + ptr, size - ptr);
-		if (n <= 0) {
-			if (!n)
-				break;
-			if (errno == EINTR)
-				continue;
-			goto fail;
-		}
-		ptr += (size_t)n;
-	}
-	if (!buffer)
-		return 0;
-	new = realloc(buffer, ptr + 2);
+	new = realloc_large(word_widths, word_capacity * sizeof(*word_widths), size * sizeof(*word_widths));
 	if (!new)
-		goto fail;
-	buffer = new;
-	buffer[ptr++] = '\0';
-	buffer[ptr++] = '\0';
-
-	/* Split words. */
-	size = 0;
-	for (s = buffer; *s; s = &end[1]) {
-		if (word_count == size) {
-			size = size ? size << 1 : 512;
-			new = realloc(words, size * sizeof(*words));
-			if (!new)
-				goto fail;
-			words = new;
-		}
-		while (isspace(*s))
-			s++;
-		end = strpbrk(s, " \f\n\r\t\v");
-		if (!end)
-			end = strchr(s, '\0');
-		*end = '\0';
-		words[word_count].word = s;
-		words[word_count].reverse_video = 0;
-		word_count++;
-	}
+		return -1;
+	word_widths = new;
 
-	/* Figure out which words should have reverse video. */
-	for (i = 1; i < word_count; i++)
-		if (!strcmp(words[i].word, words[i - 1].word))
-			words[i].reverse_video = words[i - 1].reverse_video ^ 1;
+	new = realloc_large(word_anchors, word_capacity * sizeof(*word_anchors), size * sizeof(*word_anchors));
+	if (!new)
+		return -1;
+	word_anchors = new;
 
-	return 0;
+	new = realloc_large(word_flags, word_capacity * sizeof(*word_flags), size * sizeof(*word_flags));
+	if (!new)
+		return -1;
+	word_flags = new;
 
-fail:
-	saved_errno = errno;
-	free(buffer);
-	buffer = NULL;
-	errno = saved_errno;
-	return -1;
+	word_capacity = size;
+	return 0;
 }
 
 
 /**
- * Display a file word by word.
- * 
- * @param   ttyfd  File descriptor for reading from the terminal.
- * @param   rate   The number of words per minute to display.
- * @return         0 on success, -1 on error.
+ * Deallocate all loaded words.
+ */
+void
+free_words(void)
+{
+	if (!release_index()) {
+		free(text);
+		free(word_offsets);
+		free(word_widths);
+		free(word_anchors);
+		free(word_flags);
+	}
+	text = NULL;
+	word_offsets = NULL;
+	word_widths = NULL;
+	word_anchors = NULL;
+	word_flags = NULL;
+	word_count = word_capacity = text_size = 0;
+}
+
+
+/**
+ * Add an annotator to run when the file is loaded.
+ * 
+ * @param  func  The annotator.
+ */
+static void
+add_annotator(annotator_func *func)
+{
+	if (annotator_count == MAX_ANNOTATORS)
+		abort();
+	annotators[annotator_count++] = func;
+}
+
+
+/**
+ * Annotator that measures the words.
+ * 
+ * @param  first  The index of the first word to annotate.
+ * @param  end    The index of the word after the last word to annotate.
+ */
+static void
+measure_words(size_t first, size_t end)
+{
+	size_t i, w;
+	for (i = first; i < end; i++) {
+		w = display_len(get_word(i));
+		word_widths[i] = (uint16_t)(w < UINT16_MAX ? w : UINT16_MAX);
+		w = (w + 1) / 2;
+		word_anchors[i] = (uint8_t)(w < UINT8_MAX ? w : UINT8_MAX);
+	}
+}
+
+
+/**
+ * Annotator that figures out which words should have reverse video.
+ * 
+ * @param  first  The index of the first word to annotate.
+ * @param  end    The index of the word after the last word to annotate.
+ */
+static void
+mark_repeats(size_t first, size_t end)
+{
+	size_t i;
+	for (i = first ? first : 1; i < end; i++)
+		if (!strcmp(get_word(i), get_word(i - 1)))
+			word_flags[i] |= (word_flags[i - 1] & WORD_REVERSE_VIDEO) ^ WORD_REVERSE_VIDEO;
+}
+
+
+/**
+ * Compare two strings for `bsearch`.
+ * 
+ * @param   a  The first string.
+ * @param   b  The second string.
+ * @return     Negative if `a` sorts before `b`, positive if
+ *             `a` sorts after `b`, 0 if they are equal.
  */
 static int
-display_file(int ttyfd, long rate)
+compare_strings(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+
+/**
+ * Annotator that marks the words that can be skipped when skimming.
+ * 
+ * @param  first  The index of the first word to annotate.
+ * @param  end    The index of the word after the last word to annotate.
+ */
+static void
+mark_function_words(size_t first, size_t end)
+{
+	char buf[sizeof(*function_words)];
+	const char *word;
+	size_t i, j;
+	for (i = first; i < end; i++) {
+		word = get_word(i);
+		for (j = 0; j < sizeof(buf) - 1 && isalpha((unsigned char)word[j]); j++)
+			buf[j] = (char)tolower((unsigned char)word[j]);
+		if (word[j] || !j)
+			continue;
+		buf[j] = '\0';
+		if (bsearch(buf, function_words, sizeof(function_words) / sizeof(*function_words),
+		            sizeof(*function_words), compare_strings))
+			word_flags[i] |= WORD_SKIMMABLE;
+	}
+}
+
+
+/**
+ * Split the loaded text into words, and annotate them.
+ * 
+ * @return  0 on success, -1 on error (the
+ *          words are deallocated on error).
+ */
+int
+split_words(void)
 {
-#define SET_RATE \
-	(interval.it_value.tv_usec = 60000000L / rate, \
-	 interval.it_value.tv_sec = interval.it_value.tv_usec / 1000000L, \
-	 interval.it_value.tv_usec %= 1000000L)
+	int saved_errno;
+	char *s;
+	char *end;
+	size_t i, tile;
+	int new_line = 1;
+
+	/* Reserve room for as many words as the text can have, so
+	 * that the word index is not moved as it grows, which would
+	 * split its huge pages. If it cannot be reserved, it grows
+	 * as needed. The room that is not used is released below. */
+	if (!word_capacity && text_size > 2)
+		grow_words(text_size / 2 + 1);
+
+	/* Split and annotate words, one tile at a time. */
+	for (s = text; *s;) {
+		for (tile = word_count; *s && word_count - tile < ANNOTATION_TILE; s = &end[1]) {
+			if (word_count == word_capacity)
+				if (grow_words(word_capacity ? word_capacity << 1 : 512))
+					goto fail;
+			for (; isspace(*s); s++)
+				if (*s == '\n')
+					new_line = 1;
+			end = strpbrk(s, " \f\n\r\t\v");
+			if (!end)
+				end = strchr(s, '\0');
+			word_offsets[word_count] = (size_t)(s - text);
+			word_flags[word_count] = new_line ? WORD_LINE_START : 0;
+			word_count++;
+			new_line = *end == '\n';
+			*end = '\0';
+		}
+		for (i = 0; i < annotator_count; i++)
+			annotators[i](tile, word_count);
+	}
+
+	/* Shrinking does not move the word index, and if it fails,
+	 * the room is just not released. */
+	if (word_count && word_count < word_capacity)
+		grow_words(word_count);
+
+	return 0;
+
+fail:
+	saved_errno = errno;
+	free_words();
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Load the file and do some preparsing.
+ * 
+ * @param   fd  The file descriptor to the file, -1 to clean up instead.
+ * @return      0 on success, -1 on error.
+ */
+int
+load_file(int fd)
+{
+	size_t ptr = 0;
+	size_t size = 0;
+	struct stat st;
+	void *new;
+	int saved_errno;
+	ssize_t n;
+
+	if (fd == -1)
+		return free_words(), 0;
+
+	/* Allocate all of a regular file at once, so that
+	 * the text is not moved, and copied, as it grows. */
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && (uintmax_t)st.st_size < SIZE_MAX / 2) {
+		new = realloc_large(text, 0, (size_t)st.st_size + 2);
+		if (!new)
+			goto fail;
+		text = new;
+		size = (size_t)st.st_size + 2;
+	}
+
+	/* Load file. */
+	for (;;) {
+		if (ptr == size) {
+			new = realloc_large(text, size, size ? size << 1 : 8 << 10);
+			if (!new)
+				goto fail;
+			text = new;
+			size = size ? size << 1 : 8 << 10;
+		}
+		n = read(fd, text + ptr, size - ptr);
+		if (n <= 0) {
+			if (!n)
+				break;
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		ptr += (size_t)n;
+	}
+	if (!text)
+		return 0;
+	new = realloc(text, ptr + 2);
+	if (!new)
+		goto fail;
+	text = new;
+	text[ptr++] = '\0';
+	text[ptr++] = '\0';
+	text_size = ptr;
+
+	/* Remove the lines we do not want to read before they are split,
+	 * and replace structured records with the fields we want to read. */
+	if (filter_lines() || extract_fields())
+		goto fail;
 
+	return split_words();
+
+fail:
+	saved_errno = errno;
+	free_words();
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Check whether the terminal is still processing
+ * the output of a previous frame.
+ * 
+ * @return  1 if it is, 0 otherwise.
+ */
+static int
+output_backlogged(void)
+{
+#ifdef TIOCOUTQ
+	int queued;
+#endif
+	if (frame_ptr < frame_len)
+		return 1;
+#ifdef TIOCOUTQ
+	if (!ioctl(STDOUT_FILENO, (unsigned long)TIOCOUTQ, &queued) && queued > 0)
+		return 1;
+#endif
+	return 0;
+}
+
+
+/**
+ * Format the frame that displays a word.
+ * 
+ * @param   buf     Output buffer for the frame, should have room
+ *                  for the word and `FRAME_OVERHEAD` more bytes.
+ * @param   size    The size of `buf`.
+ * @param   i       The index of the word.
+ * @param   width   The width of the terminal.
+ * @param   height  The height of the terminal.
+ * @return          The length of the frame (as `snprintf`), -1 on error.
+ */
+int
+format_word(char *buf, size_t size, size_t i, size_t width, size_t height)
+{
+	size_t col = width / 2 > word_anchors[i] ? width / 2 - word_anchors[i] : 0;
+	return snprintf(buf, size, "\033[H\033[2J\033[%zu;%zuH%s%s%s%s%s%s%s",
+	                (height + 1) / 2, col + 1,
+	                (word_flags[i] & WORD_REVERSE_VIDEO) ? "\033[7m" : "",
+	                (word_flags[i] & WORD_WATCHED) ? "\033[1;31m" : "",
+	                (word_flags[i] & WORD_INSERTED) ? "\033[4m" : (word_flags[i] & WORD_DELETED) ? "\033[9m" : "",
+	                get_word(i),
+	                (word_flags[i] & WORD_INSERTED) ? "\033[24m" : (word_flags[i] & WORD_DELETED) ? "\033[29m" : "",
+	                (word_flags[i] & WORD_WATCHED) ? "\033[22;39m" : "",
+	                (word_flags[i] & WORD_REVERSE_VIDEO) ? "\033[27m" : "");
+}
+
+
+/**
+ * Create the frame that displays a word.
+ * 
+ * @param   i  The index of the word.
+ * @return     0 on success, -1 on error.
+ */
+static int
+render_word(size_t i)
+{
+	size_t size = strlen(get_word(i)) + 2 * FRAME_OVERHEAD + sizeof("\033[6n");
+	long long now;
+	void *new;
+	int r;
+
+	if (size > frame_size) {
+		new = realloc(frame, size);
+		if (!new)
+			return -1;
+		frame = new;
+		frame_size = size;
+	}
+
+	get_terminal_size();
+	r = encode_frame(frame, frame_size, i, width, height, line_repeats(i));
+	if (r < 0)
+		return -1;
+	/* Leave room for the probe after the frame. */
+	if ((size_t)r >= frame_size - 4)
+		return errno = EOVERFLOW, -1;
+	frame_len = (size_t)r;
+	frame_ptr = 0;
+
+	/* Ask for the cursor position to measure the round-trip time. */
+	frame_has_probe = 0;
+	if (probe_rtt && !probe_outstanding) {
+		now = get_time();
+		if (now - probe_sent >= RTT_PROBE_INTERVAL) {
+			memcpy(&frame[frame_len], "\033[6n", 4);
+			frame_len += 4;
+			frame_has_probe = 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Write as much as possible of the current frame to the
+ * terminal without blocking, and if it has been written
+ * and the terminal has caught up, display the pending word.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+static int
+flush_frame(void)
+{
+	ssize_t n;
+
+	for (;;) {
+		while (frame_ptr < frame_len) {
+			n = write(output_fd, &frame[frame_ptr], frame_len - frame_ptr);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				return -1;
+			}
+			frame_ptr += (size_t)n;
+		}
+		if (frame_has_probe) {
+			frame_has_probe = 0;
+			probe_outstanding = 1;
+			probe_sent = get_time();
+		}
+		if (!have_pending_word || output_backlogged())
+			return 0;
+		if (render_word(pending_word))
+			return -1;
+		have_pending_word = 0;
+	}
+}
+
+
+/**
+ * Display a word. If the terminal has not yet caught up with
+ * the previous frame, the word is held back until it has, and
+ * if another word is displayed before that, this word is dropped.
+ * 
+ * @param   i  The index of the word.
+ * @return     0 on success, -1 on error.
+ */
+static int
+show_word(size_t i)
+{
+	if (serving)
+		broadcast_word(i);
+	pending_word = i;
+	have_pending_word = 1;
+	return flush_frame();
+}
+
+
+/**
+ * Receive words from the server, and
+ * display the last received word.
+ * 
+ * The last received word is stored as
+ * the only loaded word.
+ * 
+ * @return  0 on success, 1 if the server has
+ *          disconnected, -1 on error.
+ */
+static int
+receive_words(void)
+{
+	char *line, *end, *last = NULL, *word;
+	unsigned long flags, anchor;
+	size_t size, len, w;
+	ssize_t n;
+	void *new;
+
+	if (remote_buf_len == remote_buf_size) {
+		size = remote_buf_size ? remote_buf_size << 1 : 1024;
+		new = realloc(remote_buf, size);
+		if (!new)
+			return -1;
+		remote_buf = new;
+		remote_buf_size = size;
+	}
+	n = read(remote_fd, &remote_buf[remote_buf_len], remote_buf_size - remote_buf_len);
+	if (n <= 0) {
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			return 0;
+		return n ? -1 : 1;
+	}
+	remote_buf_len += (size_t)n;
+
+	/* Only the newest complete record is of interest. */
+	for (line = remote_buf; (end = memchr(line, '\n', remote_buf_len - (size_t)(line - remote_buf))); line = &end[1]) {
+		*end = '\0';
+		last = line;
+	}
+	if (!last)
+		return 0;
+
+	flags = strtoul(last, &word, 10);
+	anchor = strtoul(word, &word, 10);
+	if (*word == ' ')
+		word++;
+	len = strlen(word) + 1;
+	if (len + 1 > text_size) {
+		new = realloc(text, len + 1);
+		if (!new)
+			return -1;
+		text = new;
+		text_size = len + 1;
+	}
+	memcpy(text, word, len);
+	if (!word_capacity && grow_words(1))
+		return -1;
+	word_count = 1;
+	word_offsets[0] = 0;
+	word_flags[0] = (uint8_t)flags;
+	word_anchors[0] = (uint8_t)(anchor < UINT8_MAX ? anchor : UINT8_MAX);
+	w = display_len(text);
+	word_widths[0] = (uint16_t)(w < UINT16_MAX ? w : UINT16_MAX);
+
+	remote_buf_len -= (size_t)(line - remote_buf);
+	memmove(remote_buf, line, remote_buf_len);
+	return show_word(0);
+}
+
+
+/**
+ * Update the round-trip time estimate with
+ * the reply to a measurement request.
+ */
+static void
+receive_probe(void)
+{
+	long long sample, old = srtt;
+
+	if (!probe_outstanding)
+		return;
+	probe_outstanding = 0;
+	sample = get_time() - probe_sent;
+	srtt = srtt ? (7 * srtt + sample) / 8 : sample;
+
+	/* Frames now take half of the round-trip time change
+	 * longer or shorter to reach the reader. */
+	if (old)
+		schedule_correction += (srtt - old) / 2;
+}
+
+
+/**
+ * Parse a byte of input from the terminal.
+ * 
+ * Control sequences are reduced to their final
+ * byte, so that for example the arrow keys become
+ * 'A', 'B', 'C', and 'D', except replies to round-trip
+ * time measurements which are consumed.
+ * 
+ * @param   c  The byte.
+ * @return     1 if `c` shall be processed as a key, 0 otherwise.
+ */
+static int
+parse_input(char c)
+{
+	switch (input_state) {
+	case 1:
+		input_state = c == '[' ? 2 : 0;
+		return input_state ? 0 : 1;
+	case 2:
+		if (c >= 0x20 && c <= 0x3F)
+			return 0;
+		input_state = 0;
+		if (c == 'R') {
+			receive_probe();
+			return 0;
+		}
+		return 1;
+	default:
+		if (c == '\033') {
+			input_state = 1;
+			return 0;
+		}
+		return 1;
+	}
+}
+
+
+/**
+ * Wait for a key press or a command from the control socket,
+ * meanwhile writing held back frames as the terminal catches up.
+ * 
+ * @param   ttyfd  File descriptor for reading from the terminal.
+ * @param   keyp   Output parameter for the read byte, or for
+ *                 commands, a `KEY_*` constant, in which case
+ *                 `key_argument` is set to the command's argument.
+ * @return         1 if a key was read, 0 on end of file, -1 on
+ *                 error (`errno` is set to `EINTR` on signal).
+ */
+static ssize_t
+read_key(int ttyfd, int *keyp)
+{
+	struct pollfd fds[4 + MAX_CLIENTS + 1 + MAX_CONTROLLERS + 1];
+	size_t nfds, nserver, ncontrol;
+	int timeout, r;
 	ssize_t n;
-	int timer_set = 1;
+	char c, drain[16];
+
+	for (;;) {
+		if (caught_sigalrm)
+			return errno = EINTR, -1;
+		if (next_command(keyp, &key_argument))
+			return 1;
+
+		fds[0].fd = ttyfd;
+		fds[0].events = POLLIN;
+		fds[1].fd = output_fd;
+		fds[1].events = frame_ptr < frame_len ? POLLOUT : 0;
+		fds[2].fd = remote_fd;
+		fds[2].events = POLLIN;
+		fds[3].fd = alarm_pipe[0];
+		fds[3].events = POLLIN;
+		fds[0].revents = fds[1].revents = fds[2].revents = fds[3].revents = 0;
+		nfds = 4;
+		nserver = server_poll_fds(&fds[nfds]);
+		nfds += nserver;
+		ncontrol = control_poll_fds(&fds[nfds]);
+		nfds += ncontrol;
+		timeout = (have_pending_word && !fds[1].events) ? BACKLOG_POLL_TIMEOUT : -1;
+		if (poll(fds, (nfds_t)nfds, timeout) < 0)
+			return -1;
+		if (fds[3].revents)
+			while (read(alarm_pipe[0], drain, sizeof(drain)) > 0);
+		server_handle_fds(&fds[4], nserver);
+		control_handle_fds(&fds[4 + nserver], ncontrol);
+		if (fds[2].revents) {
+			r = receive_words();
+			if (r)
+				return r < 0 ? -1 : 0;
+		}
+		if (fds[1].revents || have_pending_word)
+			if (flush_frame())
+				return -1;
+		if (fds[0].revents) {
+			n = read(ttyfd, &c, sizeof(c));
+			if (n <= 0)
+				return n;
+			if (parse_input(c)) {
+				*keyp = (unsigned char)c;
+				return 1;
+			}
+		}
+	}
+}
+
+
+/**
+ * Wait, for a limited time, for the reply to an outstanding
+ * round-trip time measurement request, so that it is not
+ * left as input for the next program to use the terminal.
+ * 
+ * @param  ttyfd  File descriptor for reading from the terminal.
+ */
+static void
+await_probe(int ttyfd)
+{
+	struct pollfd pfd;
+	long long timeout;
 	char c;
-	size_t i;
-	struct itimerval interval;
 
-	memset(&interval, 0, sizeof(interval));
+	while (probe_outstanding) {
+		timeout = RTT_PROBE_TIMEOUT - (get_time() - probe_sent);
+		if (timeout <= 0)
+			break;
+		pfd.fd = ttyfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (int)((timeout + 999) / 1000)) <= 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (read(ttyfd, &c, sizeof(c)) <= 0)
+			break;
+		parse_input(c);
+	}
+}
+
+
+/**
+ * Get the number of words that has been displayed
+ * since the word the reader is looking at.
+ * 
+ * @param   rate  The number of words per minute,
+ *                multiplied by `RATE_SCALE`.
+ * @return        The number of words the reader lags behind.
+ */
+static size_t
+lag_words(long rate)
+{
+	/* The word takes half the round-trip time to reach
+	 * the reader, and the key press takes the other half
+	 * to come back. */
+	return (size_t)((srtt * (long long)rate + 30000000LL * RATE_SCALE) / (60000000LL * RATE_SCALE));
+}
+
+
+/**
+ * Stop the timer, and forget any expiration
+ * that has not been acted on yet.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+static int
+disarm_timer(void)
+{
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	if (setitimer(ITIMER_REAL, &timer, NULL))
+		return -1;
+	caught_sigalrm = 0;
+	return 0;
+}
+
+
+/**
+ * Start the timer for the next word, displaying it earlier or later
+ * to compensate for changes in the latency of the terminal.
+ * 
+ * @param   deadline  The time, in nanoseconds on the monotonic clock,
+ *                    the next word shall be displayed; will be updated
+ *                    with the compensation for the terminal's latency.
+ *                    If it has already passed, `caught_sigalrm` is set
+ *                    instead of starting the timer.
+ * @return            0 on success, -1 on error.
+ */
+static int
+arm_timer(long long *deadline)
+{
+	struct itimerval timer;
+	long long usec;
+
+	*deadline -= schedule_correction * 1000LL;
+	schedule_correction = 0;
+
+	/* Do not let the previous deadline tick for this one. */
+	if (disarm_timer())
+		return -1;
+
+	usec = (*deadline - get_time() * 1000LL + 999LL) / 1000LL;
+	if (usec < 1) {
+		/* Already late, so take the tick right away
+		 * rather than have SIGALRM deliver it. */
+		caught_sigalrm = 1;
+		return 0;
+	}
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = (time_t)(usec / 1000000LL);
+	timer.it_value.tv_usec = (suseconds_t)(usec % 1000000LL);
+	return setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+
+/**
+ * Open the file descriptor frames are written to.
+ * 
+ * @return  A non-blocking file descriptor to the terminal,
+ *          or `STDOUT_FILENO` if stdout is not a terminal
+ *          or the terminal cannot be opened.
+ */
+static int
+open_output(void)
+{
+	const char *name;
+	int fd;
+	if (!isatty(STDOUT_FILENO) || !(name = ttyname(STDOUT_FILENO)))
+		return STDOUT_FILENO;
+	fd = open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+	return fd < 0 ? STDOUT_FILENO : fd;
+}
+
+
+/**
+ * Stop dropping frames: write the remainder of the
+ * current frame, blocking, and close the file
+ * descriptor frames are written to.
+ */
+static void
+finish_frames(void)
+{
+	ssize_t n;
+	int flags;
+	if (output_fd < 0)
+		return;
+	if (output_fd != STDOUT_FILENO) {
+		flags = fcntl(output_fd, F_GETFL);
+		if (flags >= 0)
+			fcntl(output_fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+	while (frame_ptr < frame_len) {
+		n = write(output_fd, &frame[frame_ptr], frame_len - frame_ptr);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		frame_ptr += (size_t)n;
+	}
+	if (output_fd != STDOUT_FILENO)
+		close(output_fd);
+	output_fd = -1;
+	free(frame);
+	frame = NULL;
+	frame_size = frame_len = frame_ptr = 0;
+}
+
+
+/**
+ * Get the word that was displayed a number of words before
+ * another word, not counting words that are skipped.
+ * 
+ * @param   i     The index of the word to count from.
+ * @param   n     The number of words to go back.
+ * @param   skim  Whether words with `WORD_SKIMMABLE` are skipped.
+ * @return        The index of the word, 0 if there are not
+ *                enough displayed words before word `i`.
+ */
+static size_t
+words_back(size_t i, size_t n, int skim)
+{
+	size_t first, end;
+	while (n && i) {
+		if (line_hidden(--i, &first, &end))
+			i = first;
+		else if (!skim || !(word_flags[i] & WORD_SKIMMABLE))
+			n--;
+	}
+	return i;
+}
+
+
+/**
+ * Get the first word, starting at some word,
+ * that is not skipped.
+ * 
+ * @param   i     The index of the word to start at.
+ * @param   skim  Whether words with `WORD_SKIMMABLE` are skipped.
+ * @return        The index of the word, `word_count`
+ *                if all remaining words are skipped.
+ */
+static size_t
+words_forward(size_t i, int skim)
+{
+	size_t first, end;
+	while (i < word_count) {
+		if (line_hidden(i, &first, &end))
+			i = end;
+		else if (skim && (word_flags[i] & WORD_SKIMMABLE))
+			i++;
+		else
+			break;
+	}
+	return i;
+}
+
+
+/**
+ * Get the first word of a line.
+ * 
+ * @param   i  The index of a word in the line.
+ * @return     The index of the first word in the line.
+ */
+static size_t
+line_start(size_t i)
+{
+	while (i && !(word_flags[i] & WORD_LINE_START))
+		i--;
+	return i;
+}
+
+
+/**
+ * Get the first word of the line after a word's line.
+ * 
+ * @param   i  The index of a word.
+ * @return     The index of the first word of the
+ *             next line, `word_count` if none.
+ */
+static size_t
+next_line_start(size_t i)
+{
+	while (++i < word_count && !(word_flags[i] & WORD_LINE_START));
+	return i;
+}
+
+
+/**
+ * Display a file word by word.
+ * 
+ * @param   ttyfd     File descriptor for reading from the terminal.
+ * @param   rate      The number of words per minute to display,
+ *                    multiplied by `RATE_SCALE`.
+ * @param   schedule  The rate schedule, `NULL` for a constant rate.
+ * @param   replay    How lines are paced by their timestamps,
+ *                    `NULL` if only the words are paced.
+ * @param   adapter   The adapter that adjusts the rate to the
+ *                    reader's behaviour, `NULL` to keep the rate.
+ * @param   skim      Whether words with `WORD_SKIMMABLE` are skipped.
+ * @return            0 on success, -1 on error.
+ */
+static int
+display_file(int ttyfd, long rate, const struct schedule *schedule, const struct replay *replay,
+             struct adapter *adapter, int skim)
+{
+	ssize_t n;
+	int timer_set = 1, ticked = 0;
+	int c;
+	size_t i, lag;
+	long long target, deadline = 0;
+	struct pacer pacer;
+
+	pacer_init(&pacer, rate, schedule);
+	pacer_replay(&pacer, replay);
 
-	SET_RATE;
 	for (i = 0; i < word_count; i++) {
-		if (setitimer(ITIMER_REAL, &interval, NULL))
-			goto fail;
+		/* Words displayed when the timer expires are timed from
+		 * when the previous word was supposed to be displayed,
+		 * so that no time is lost; other words from now, in
+		 * which case the lines are not paced from earlier lines. */
+		if (timer_set) {
+			if (!ticked) {
+				deadline = get_time() * 1000LL;
+				pacer.have_line = 0;
+			}
+			deadline += pacer_next(&pacer);
+			if (replay)
+				deadline = pacer_line(&pacer, words_forward(i, skim), deadline);
+			if (arm_timer(&deadline))
+				goto fail;
+		}
+		ticked = 0;
 	rewait:
-		n = read(ttyfd, &c, sizeof(c));
+		n = read_key(ttyfd, &c);
 		if (n < 0) {
 			if (errno != EINTR)
 				goto fail;
@@ -324,54 +1566,121 @@ display_file(int ttyfd, long rate)
 		switch (c) {
 		case '+': /* plus */
 		case '-': /* hyphen */
-			rate += c == '+' ? RATE_DELTA : -RATE_DELTA;
-			rate = rate <= 0 ? 1 : rate;
-			SET_RATE;
+			rate += (c == '+' ? RATE_DELTA : -RATE_DELTA) * RATE_SCALE;
+			rate = rate <= 0 ? RATE_SCALE : rate;
+			pacer_set_rate(&pacer, rate);
 			goto rewait;
 		case 'p': /* P */
-			if (timer_set)
-				memset(&interval, 0, sizeof(interval));
-			else
-				SET_RATE;
-			if (setitimer(ITIMER_REAL, &interval, NULL))
-				goto fail;
+			if (timer_set) {
+				if (disarm_timer())
+					goto fail;
+			} else {
+				deadline = get_time() * 1000LL + pacer_next(&pacer);
+				if (arm_timer(&deadline))
+					goto fail;
+			}
 			timer_set ^= 1;
+			if (!timer_set && adapter) {
+				rate = adapter_intervene(adapter, INTERVENTION_PAUSE, rate);
+				pacer_set_rate(&pacer, rate);
+			}
+			if (!timer_set && i && (lag = lag_words(pacer.current_rate))) {
+				/* Pause at the word the reader saw. */
+				i = words_back(i - 1, lag, skim) + 1;
+				if (show_word(i - 1))
+					goto fail;
+			}
 			goto rewait;
 		case 'q': /* Q */
 			goto done;
+		case '\f': /* ^L */
+			invalidate_frames();
+			if (i && show_word(i - 1))
+				goto fail;
+			goto rewait;
+		case 'e': /* E */
+			if (i)
+				expand_lines(i - 1);
+			goto rewait;
 		case 'B': /* down */
 		case 'C': /* right */
 			break;
 		case 'A': /* up */
 		case 'D': /* left */
-			i = i < 2 ? 0 : i - 2;
+			lag = timer_set ? lag_words(pacer.current_rate) : 0;
+			i = i ? words_back(i - 1, 1 + lag, skim) : 0;
+			if (adapter) {
+				rate = adapter_intervene(adapter, INTERVENTION_REWIND, rate);
+				pacer_set_rate(&pacer, rate);
+			}
+			break;
+		case '[':
+			/* Go to the beginning of the line, or to
+			 * the previous line if already there. */
+			lag = timer_set ? lag_words(pacer.current_rate) : 0;
+			i = i ? words_back(i - 1, lag, skim) : 0;
+			i = (i && line_start(i) == i) ? line_start(i - 1) : line_start(i);
+			if (adapter) {
+				rate = adapter_intervene(adapter, INTERVENTION_REWIND, rate);
+				pacer_set_rate(&pacer, rate);
+			}
+			break;
+		case ']':
+			i = i ? next_line_start(i - 1) : 0;
+			break;
+		case KEY_SEEK:
+		case KEY_SKIP:
+			/* Word numbers start at 1, and the
+			 * displayed word is the one before `i`. */
+			if (c == KEY_SEEK)
+				target = (long long)key_argument - 1;
+			else
+				target = (long long)i - 1 + (long long)key_argument;
+			if (target >= (long long)word_count)
+				target = (long long)word_count - 1;
+			i = target < 0 ? 0 : (size_t)target;
 			break;
 		case 0:
 			if (!caught_sigalrm)
 				goto rewait;
 			caught_sigalrm = 0;
+			ticked = 1;
+			if (adapter) {
+				rate = adapter_advance(adapter, rate);
+				pacer_set_rate(&pacer, rate);
+			}
 			break;
 		default:
 			goto rewait;
 		}
 
-		get_terminal_size();
-		if (fprintf(stdout, "\033[H\033[2J\033[%zu;%zuH%s%s%s",
-		            (height + 1) / 2,
-		            (width - display_len(words[i].word)) / 2 + 1,
-		            words[i].reverse_video ? "\033[7m" : "",
-		            words[i].word,
-		            words[i].reverse_video ? "\033[27m" : "") < 0)
-			goto fail;
-		if (fflush(stdout))
+		i = words_forward(i, skim);
+		if (i == word_count)
+			break;
+		if (show_word(i))
 			goto fail;
+		if (ticked)
+			record_lateness(get_time() - deadline / 1000LL);
+
+		/* Stop at words in the watchlist, so they are not missed. */
+		if (pause_on_watch && ticked && timer_set && (word_flags[i] & WORD_WATCHED)) {
+			if (disarm_timer())
+				goto fail;
+			timer_set = 0;
+		}
 	}
 
-	if (setitimer(ITIMER_REAL, &interval, NULL))
-		goto fail;
-	(void) read(ttyfd, &c, sizeof(c));
+	if (timer_set) {
+		if (!ticked)
+			deadline = get_time() * 1000LL;
+		deadline += pacer_next(&pacer);
+		if (arm_timer(&deadline))
+			goto fail;
+	}
+	(void) read_key(ttyfd, &c);
 
 done:
+	await_probe(ttyfd);
 	return 0;
 
 fail:
@@ -379,35 +1688,202 @@ fail:
 }
 
 
+/**
+ * Display the words served by a server.
+ * 
+ * @param   ttyfd  File descriptor for reading from the terminal.
+ * @return         0 on success, -1 on error.
+ */
+static int
+display_remote(int ttyfd)
+{
+	ssize_t n;
+	int c;
+
+	for (;;) {
+		n = read_key(ttyfd, &c);
+		if (n < 0) {
+			if (errno != EINTR)
+				return -1;
+			continue;
+		}
+		if (!n || c == 'q')
+			break;
+	}
+
+	await_probe(ttyfd);
+	return 0;
+}
+
+
+/**
+ * Attach to a server.
+ * 
+ * @param   path  The pathname of the server's socket.
+ * @return        0 on success, -1 on error.
+ */
+static int
+connect_to_server(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return errno = ENAMETOOLONG, -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	remote_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (remote_fd < 0)
+		return -1;
+	if (connect(remote_fd, (void *)&addr, (socklen_t)sizeof(addr))) {
+		close(remote_fd);
+		remote_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+
 int
 main(int argc, char *argv[])
 {
-	long rate = get_word_rate();
-	int fd = -1, ttyfd = -1, tty_configured = 0;
+	long rate = get_word_rate("READ_QUICKLY_RATE", DEFAULT_RATE * RATE_SCALE);
+	int fd = -1, old_fd = -1, ttyfd = -1, tty_configured = 0;
+	const char *serve_path = NULL, *attach_path = NULL, *control_path = NULL;
+	const char *export_format = NULL, *watchlist = NULL;
+	int realtime = 0, adapt = 0, skim = 0, collapse = 0, filtered = 0, extracting = 0, scheduled;
+	int precise = 0, measure = 0, build = 0, memory = 0, indexing = 0;
+	long factor = 0;
+	struct adapter adapter;
+	struct schedule schedule;
+	struct replay replay;
 	struct termios stty, saved_stty;
 	struct stat _attr;
 	struct sigaction sa;
+	int opt, r;
 
 	/* Parse arguments. */
-	argv0 = argv ? (argc--, *argv++) : "read-quickly";
-	if (argc && argv[0][0] == '-') {
-		if (argv[0][1] == '-' && !argv[0][2]) {
-			argc--;
-			argv++;
-		} else if (argv[0][1]) {
+	argv0 = argv && *argv ? *argv : "read-quickly";
+	while ((opt = getopt(argc, argv, "abc:f:g:G:ijklmPr:s:t:uUw:W:x:")) != -1) {
+		switch (opt) {
+		case 'a':
+			adapt = 1;
+			break;
+		case 'b':
+			build = 1;
+			break;
+		case 'c':
+			attach_path = optarg;
+			break;
+		case 'f':
+			if (add_fields(optarg))
+				goto fail;
+			extracting = 1;
+			break;
+		case 'g':
+		case 'G':
+			if (add_line_filter(optarg, opt == 'G'))
+				goto fail;
+			filtered = 1;
+			break;
+		case 'i':
+			indexing = 1;
+			break;
+		case 'j':
+			measure = 1;
+			break;
+		case 'k':
+			skim = 1;
+			break;
+		case 'l':
+			realtime = 1;
+			break;
+		case 'm':
+			memory = 1;
+			break;
+		case 'P':
+			precise = 1;
+			break;
+		case 'r':
+			control_path = optarg;
+			break;
+		case 's':
+			serve_path = optarg;
+			break;
+		case 't':
+			factor = get_factor(optarg);
+			if (!factor)
+				goto usage;
+			break;
+		case 'u':
+			collapse = collapse ? collapse : 1;
+			break;
+		case 'U':
+			collapse = 2;
+			break;
+		case 'W':
+			pause_on_watch = 1;
+			/* fall through */
+		case 'w':
+			watchlist = optarg;
+			break;
+		case 'x':
+			export_format = optarg;
+			if (!is_export_format(export_format))
+				goto usage;
+			break;
+		default:
 			goto usage;
 		}
 	}
-	if (argc > 1)
+	argc -= optind;
+	argv += optind;
+	if (build) {
+		if (!argc || attach_path || serve_path || control_path || export_format || watchlist || factor ||
+		    adapt || skim || collapse || filtered || extracting || realtime || precise || measure || memory || indexing)
+			goto usage;
+		add_annotator(&measure_words);
+		add_annotator(&mark_repeats);
+		add_annotator(&mark_function_words);
+		return build_indexes(argv0, argv, (size_t)argc) ? 1 : 0;
+	}
+	if (argc > 2 || (argc == 2 && !strcmp(argv[0], "-") && !strcmp(argv[1], "-")))
+		goto usage;
+	if (attach_path && (serve_path || control_path || export_format || argc))
+		goto usage;
+	if (export_format && (serve_path || control_path))
+		goto usage;
+	if (realtime && !export_format)
+		goto usage;
+	if ((adapt || skim || collapse || pause_on_watch || precise || measure) && (attach_path || export_format))
+		goto usage;
+	if ((watchlist || filtered || extracting || factor || memory || indexing) && attach_path)
 		goto usage;
 
+	scheduled = get_schedule(&schedule);
+	if (factor)
+		get_replay(&replay, factor);
+
 	/* Check that we have a stdout. */
 	if (fstat(STDOUT_FILENO, &_attr))
 		if (errno == EBADF)
 			goto fail;
 
-	/* Open file. */
-	if (argc && strcmp(*argv, "-")) {
+	/* Open the old version of the file, when comparing two versions. */
+	if (argc == 2) {
+		old_fd = strcmp(*argv, "-") ? open(*argv, O_RDONLY) : STDIN_FILENO;
+		if (old_fd < 0)
+			goto fail;
+		argv++;
+	}
+
+	/* Attach to the server, or open file. */
+	if (attach_path) {
+		if (connect_to_server(attach_path))
+			goto fail;
+		goto loaded;
+	} else if (argc && strcmp(*argv, "-")) {
 		fd = open(*argv, O_RDONLY);
 		if (fd < 0)
 			goto fail;
@@ -416,13 +1892,63 @@ main(int argc, char *argv[])
 	}
 
 	/* Load file. */
-	if (load_file(fd))
+	add_annotator(&measure_words);
+	add_annotator(&mark_repeats);
+	add_annotator(&mark_function_words);
+	if (watchlist) {
+		if (load_watchlist(watchlist))
+			goto fail;
+		add_annotator(&mark_watched_words);
+	}
+	/* Neither the watched words, the filtered lines, the extracted fields,
+	 * nor the differences between two versions are stored in index files. */
+	if (old_fd >= 0 ? load_diff(old_fd, fd) :
+	    (watchlist || filtered || extracting) ? load_file(fd) : load_indexed_file(fd, indexing))
 		goto fail;
+	free_watchlist();
+	free_line_filters();
+	free_fields();
 
 	/* We do not need the file anymore. */
 	close(fd);
 	fd = -1;
+	if (old_fd >= 0) {
+		close(old_fd);
+		old_fd = -1;
+	}
+
+	/* Find the timestamps of the lines, to pace them by. */
+	if (factor && load_timestamps())
+		goto fail;
 
+	/* Export the words instead of displaying them. */
+	if (export_format) {
+		r = export_words(export_format, rate, scheduled ? &schedule : NULL, factor ? &replay : NULL, realtime);
+		if (r < 0)
+			goto fail;
+		if (memory)
+			report_memory(argv0);
+		free_timestamps();
+		load_file(-1);
+		return r;
+	}
+
+	/* Collapse repeated lines. */
+	if (collapse && collapse_lines(collapse == 2))
+		goto fail;
+
+	/* Start serving the words to clients. */
+	if (serve_path) {
+		if (start_server(serve_path))
+			goto fail;
+		serving = 1;
+	}
+
+	/* Start accepting commands over the control socket. */
+	if (control_path && start_control(control_path))
+		goto fail;
+
+loaded:
 	/* Get a readable file descriptor for the controlling terminal. */
 	ttyfd = open("/dev/tty", O_RDONLY);
 	if (ttyfd < 0)
@@ -441,42 +1967,87 @@ main(int argc, char *argv[])
 		goto fail;
 	tty_configured = 1;
 
+	/* Measure the round-trip time if the output goes to a terminal. */
+	probe_rtt = isatty(STDOUT_FILENO);
+
+	/* Write frames without blocking so that stale frames can be dropped. */
+	output_fd = open_output();
+
 	/* Display file. */
+	if (pipe(alarm_pipe))
+		goto fail;
+	if (fcntl(alarm_pipe[0], F_SETFL, O_NONBLOCK) || fcntl(alarm_pipe[1], F_SETFL, O_NONBLOCK))
+		goto fail;
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = sigalrm;
 	sigaction(SIGALRM, &sa, NULL);
 	sa.sa_handler = sigwinch;
 	sigaction(SIGWINCH, &sa, NULL);
-	if (display_file(ttyfd, rate))
+	if (precise)
+		setup_realtime(get_cpu("READ_QUICKLY_CPU"));
+	if (measure)
+		start_jitter_measurement();
+	if (adapt)
+		adapter_init(&adapter,
+		             get_word_rate("READ_QUICKLY_MIN_RATE", (rate + 1) / 2),
+		             get_word_rate("READ_QUICKLY_MAX_RATE", rate > LONG_MAX / 2 ? rate : rate * 2));
+	if (attach_path ? display_remote(ttyfd) :
+	    display_file(ttyfd, rate, scheduled ? &schedule : NULL, factor ? &replay : NULL, adapt ? &adapter : NULL, skim))
 		goto fail;
 
 	/* Restore terminal configurations. */
+	finish_frames();
 	tcsetattr(ttyfd, TCSAFLUSH, &saved_stty);
-	fprintf(stdout, "\033[?25h\033[?1049l");
+	fprintf(stdout, "\033[m\033[?25h\033[?1049l");
 	fflush(stdout);
 	tty_configured = 0;
+	report_jitter(argv0);
+	if (memory)
+		report_memory(argv0);
 
-	free(words);
+	stop_server();
+	stop_control();
+	if (remote_fd >= 0)
+		close(remote_fd);
+	close_alarm_pipe();
+	free(remote_buf);
+	free_line_runs();
+	free_timestamps();
 	load_file(-1);
 	close(ttyfd);
 	return 0;
 
 fail:
 	perror(argv0);
-	free(words);
+	stop_server();
+	stop_control();
+	if (remote_fd >= 0)
+		close(remote_fd);
+	close_alarm_pipe();
+	free(remote_buf);
+	free_line_runs();
+	free_timestamps();
+	free_watchlist();
+	free_line_filters();
+	free_fields();
 	load_file(-1);
 	if (tty_configured) {
+		finish_frames();
 		tcsetattr(ttyfd, TCSAFLUSH, &saved_stty);
-		fprintf(stdout, "\033[?25h\033[?1049l");
+		fprintf(stdout, "\033[m\033[?25h\033[?1049l");
 		fflush(stdout);
 	}
 	if (fd >= 0)
 		close(fd);
+	if (old_fd >= 0 && old_fd != fd)
+		close(old_fd);
 	if (ttyfd >= 0)
 		close(ttyfd);
 	return 1;
 
 usage:
-	fprintf(stderr, "usage: %s [file].\n", argv0);
+	fprintf(stderr, "usage: %s [-aijkmPuU] [-f fields] [-g regex] [-G regex] [-t factor] [-w file | -W file] "
+	                "[-r socket] [-s socket] [[old-file] file] | -c socket | [-ilm] [-f fields] [-g regex] "
+	                "[-G regex] [-t factor] [-w file] -x format [[old-file] file] | -b path ...\n", argv0);
 	return 1;
 }
@@ -0,0 +1,215 @@
+/* See LICENSE file for copyright and license details. */
+#ifdef __linux__
+# define _GNU_SOURCE
+#endif
+#include "common.h"
+
+#include <sched.h>
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
+
+
+
+/**
+ * Whether lateness shall be recorded.
+ */
+static int measuring = 0;
+
+/**
+ * The recorded lateness of each word, in microseconds.
+ */
+static uint32_t *samples = NULL;
+
+/**
+ * The number of elements in `samples`.
+ */
+static size_t sample_count = 0;
+
+/**
+ * The allocation size of `samples`.
+ */
+static size_t sample_capacity = 0;
+
+/**
+ * What `setup_realtime` managed to set up,
+ * a combination of `enum realtime_grant`.
+ */
+static int granted = 0;
+
+/**
+ * The CPU the process was pinned to,
+ * if `granted` has `REALTIME_PINNED`.
+ */
+static long pinned_cpu;
+
+
+
+/**
+ * Try to give the process a real-time scheduling policy, at the
+ * lowest real-time priority, so that it is not descheduled in
+ * favour of ordinary processes when a word is due; SCHED_FIFO is
+ * tried first, then SCHED_RR. If neither is permitted, the timer
+ * slack is reduced to a minimum instead, so that timers expire
+ * as close to their deadlines as the kernel allows.
+ * 
+ * Then the memory in use is locked, so that the words, and the
+ * buffers frames are rendered into, are not paged out; memory
+ * allocated later is not locked, as that could make allocations
+ * fail. Finally, if `cpu` is non-negative, the process is pinned
+ * to that CPU.
+ * 
+ * Nothing that is not permitted is treated as an error.
+ * 
+ * @param   cpu  The CPU to pin the process to, -1 to not pin it.
+ * @return       What was set up, a combination of `enum realtime_grant`.
+ */
+int
+setup_realtime(long cpu)
+{
+	struct sched_param param;
+#ifdef __linux__
+	cpu_set_t set;
+#endif
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (param.sched_priority >= 0 && !sched_setscheduler(0, SCHED_FIFO, &param)) {
+		granted |= REALTIME_FIFO;
+	} else {
+		param.sched_priority = sched_get_priority_min(SCHED_RR);
+		if (param.sched_priority >= 0 && !sched_setscheduler(0, SCHED_RR, &param))
+			granted |= REALTIME_RR;
+	}
+
+#ifdef __linux__
+	if (!(granted & (REALTIME_FIFO | REALTIME_RR)) && !prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL))
+		granted |= REALTIME_TIMERSLACK;
+#endif
+
+	if (!mlockall(MCL_CURRENT))
+		granted |= REALTIME_LOCKED;
+
+#ifdef __linux__
+	if (cpu >= 0 && cpu < CPU_SETSIZE) {
+		CPU_ZERO(&set);
+		CPU_SET((int)cpu, &set);
+		if (!sched_setaffinity(0, sizeof(set), &set)) {
+			granted |= REALTIME_PINNED;
+			pinned_cpu = cpu;
+		}
+	}
+#else
+	(void) cpu;
+#endif
+
+	return granted;
+}
+
+
+/**
+ * Start recording how late words are displayed.
+ */
+void
+start_jitter_measurement(void)
+{
+	measuring = 1;
+}
+
+
+/**
+ * Record how late a word was displayed.
+ * Does nothing unless `start_jitter_measurement`
+ * has been called.
+ * 
+ * @param  lateness  The time, in microseconds, from when the
+ *                   word was due to when it was displayed.
+ */
+void
+record_lateness(long long lateness)
+{
+	void *new;
+	if (!measuring)
+		return;
+	if (sample_count == sample_capacity) {
+		new = realloc(samples, (sample_capacity ? sample_capacity << 1 : 1024) * sizeof(*samples));
+		if (!new) {
+			/* Losing samples is better than losing the reading. */
+			measuring = 0;
+			return;
+		}
+		samples = new;
+		sample_capacity = sample_capacity ? sample_capacity << 1 : 1024;
+	}
+	lateness = lateness < 0 ? 0 : lateness > UINT32_MAX ? UINT32_MAX : lateness;
+	samples[sample_count++] = (uint32_t)lateness;
+}
+
+
+/**
+ * Compare two samples for `qsort`.
+ * 
+ * @param   a  One of the samples.
+ * @param   b  The other sample.
+ * @return     Negative if `a` is less than `b`, positive
+ *             if `a` is greater than `b`, 0 otherwise.
+ */
+static int
+compare_samples(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Get a percentile of the sorted samples.
+ * 
+ * @param   p  The percentile, in tenths of a percent.
+ * @return     The sample at the percentile.
+ */
+static uint32_t
+percentile(size_t p)
+{
+	size_t i = (sample_count * p + 999) / 1000;
+	return samples[i ? i - 1 : 0];
+}
+
+
+/**
+ * Print how late words were displayed, and what real-time
+ * facilities were used, to stderr, and stop recording.
+ * 
+ * @param  prog  The name of the program.
+ */
+void
+report_jitter(const char *prog)
+{
+	if (!measuring)
+		return;
+
+	fprintf(stderr, "%s: scheduling: %s, memory %s", prog,
+	        (granted & REALTIME_FIFO) ? "SCHED_FIFO" :
+	        (granted & REALTIME_RR) ? "SCHED_RR" :
+	        (granted & REALTIME_TIMERSLACK) ? "minimal timer slack" : "default",
+	        (granted & REALTIME_LOCKED) ? "locked" : "not locked");
+	if (granted & REALTIME_PINNED)
+		fprintf(stderr, ", pinned to CPU %li", pinned_cpu);
+	fprintf(stderr, "\n");
+
+	if (!sample_count) {
+		fprintf(stderr, "%s: lateness: no words were timed\n", prog);
+	} else {
+		qsort(samples, sample_count, sizeof(*samples), compare_samples);
+		fprintf(stderr, "%s: lateness over %zu words: p50 %lu us, p90 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\n",
+		        prog, sample_count,
+		        (unsigned long)percentile(500), (unsigned long)percentile(900),
+		        (unsigned long)percentile(990), (unsigned long)percentile(999),
+		        (unsigned long)samples[sample_count - 1]);
+	}
+
+	free(samples);
+	samples = NULL;
+	sample_count = sample_capacity = 0;
+	measuring = 0;
+}
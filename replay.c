@@ -0,0 +1,334 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The timestamp of a line.
+ */
+struct line_time {
+	/**
+	 * The index of the first word of the line.
+	 */
+	size_t word;
+
+	/**
+	 * The time, in nanoseconds since an
+	 * arbitrary point in time, of the line.
+	 */
+	long long t;
+};
+
+
+
+/**
+ * The timestamps of the lines that have
+ * one, ordered by their first words.
+ */
+static struct line_time *times = NULL;
+
+/**
+ * The number of elements in `times`.
+ */
+static size_t time_count = 0;
+
+
+
+/**
+ * Parse a number with a fixed number of digits.
+ * 
+ * @param   sp  The string, will be updated to
+ *              point to the byte after the number.
+ * @param   n   The number of digits.
+ * @param   vp  Output parameter for the number.
+ * @return      1 on success, 0 if the string does
+ *              not start with `n` digits.
+ */
+static int
+parse_digits(const char **sp, int n, long *vp)
+{
+	const char *s = *sp;
+	long v = 0;
+	for (; n--; s++) {
+		if (!isdigit(*s))
+			return 0;
+		v = v * 10 + (*s - '0');
+	}
+	*sp = s;
+	*vp = v;
+	return 1;
+}
+
+
+/**
+ * Parse a time of day, HH:MM:SS with an optional
+ * fraction of a second after a '.' or a ','.
+ * 
+ * @param   sp  The string, will be updated to point
+ *              to the byte after the time of day.
+ * @param   tp  Output parameter for the time of day,
+ *              in nanoseconds since midnight.
+ * @return      1 on success, 0 if the string does
+ *              not start with a time of day.
+ */
+static int
+parse_time_of_day(const char **sp, long long *tp)
+{
+	const char *s = *sp;
+	long h, m, sec;
+	long long frac = 0, scale = 1000000000LL;
+
+	if (!parse_digits(&s, 2, &h) || *s++ != ':' || h > 24)
+		return 0;
+	if (!parse_digits(&s, 2, &m) || *s++ != ':' || m > 59)
+		return 0;
+	if (!parse_digits(&s, 2, &sec) || sec > 60)
+		return 0;
+	if ((*s == '.' || *s == ',') && isdigit(s[1]))
+		for (s++; isdigit(*s); s++)
+			if ((scale /= 10))
+				frac += (*s - '0') * scale;
+
+	*tp = ((long long)h * 3600 + m * 60 + sec) * 1000000000LL + frac;
+	*sp = s;
+	return 1;
+}
+
+
+/**
+ * Get the number of days between 1970-01-01 and a date.
+ * 
+ * @param   y  The year.
+ * @param   m  The month, 1 for January.
+ * @param   d  The day of the month.
+ * @return     The number of days.
+ */
+static long long
+days_from_civil(long y, long m, long d)
+{
+	long long era, yoe, doy, doe;
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+
+/**
+ * Parse a timezone designator, Z, or an offset from UTC
+ * in the form +HH, +HHMM, or +HH:MM, or with '-' instead
+ * of '+'. A missing designator is parsed as UTC.
+ * 
+ * @param   sp  The string, will be updated to point
+ *              to the byte after the designator.
+ * @return      The offset in nanoseconds.
+ */
+static long long
+parse_zone(const char **sp)
+{
+	const char *s = *sp;
+	long h, m = 0;
+	int neg;
+
+	if (*s == 'Z') {
+		*sp = &s[1];
+		return 0;
+	}
+	if (*s != '+' && *s != '-')
+		return 0;
+	neg = *s++ == '-';
+	if (!parse_digits(&s, 2, &h))
+		return 0;
+	if (*s == ':')
+		s++;
+	if (isdigit(*s) && !parse_digits(&s, 2, &m))
+		return 0;
+	*sp = s;
+	return (neg ? -1 : 1) * ((long long)h * 60 + m) * 60000000000LL;
+}
+
+
+/**
+ * Check that a timestamp is followed by
+ * nothing but punctuation in its word.
+ * 
+ * @param   s  The byte after the timestamp.
+ * @return     1 if the timestamp ends the word, 0 otherwise.
+ */
+static int
+timestamp_ends(const char *s)
+{
+	while (ispunct(*s))
+		s++;
+	return !*s;
+}
+
+
+/**
+ * Parse the timestamp at the beginning of a line.
+ * 
+ * Recognised timestamps are ISO 8601 date and times, with
+ * 'T' or a space between the date and the time; times
+ * of day without a date; syslog timestamps ("Jan  2
+ * 15:04:05"); and Unix times in seconds, with an optional
+ * fraction, or in milli-, micro-, or nanoseconds. The
+ * timestamp may be preceded by a '['.
+ * 
+ * @param   i    The index of the first word of the line.
+ * @param   end  The index of the first word of the next line.
+ * @param   tp   Output parameter for the time, in nanoseconds
+ *               since an arbitrary point in time.
+ * @return       1 if the line has a timestamp, 0 otherwise.
+ */
+static int
+parse_timestamp(size_t i, size_t end, long long *tp)
+{
+	static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+	const char *s = get_word(i), *p;
+	long y, mo, d;
+	long long t, scale;
+	size_t n, k;
+
+	if (*s == '[' && !s[1] && i + 1 < end)
+		s = get_word(++i);
+	else if (*s == '[')
+		s++;
+
+	/* ISO 8601 */
+	if (parse_digits(&s, 4, &y) && (*s == '-' || *s == '/')) {
+		if (!parse_digits((s++, &s), 2, &mo) || (*s != '-' && *s != '/') || mo < 1 || mo > 12)
+			return 0;
+		if (!parse_digits((s++, &s), 2, &d) || d < 1 || d > 31)
+			return 0;
+		if (*s == 'T') {
+			s++;
+		} else if (!*s && i + 1 < end) {
+			s = get_word(++i);
+		} else {
+			return 0;
+		}
+		if (!parse_time_of_day(&s, &t))
+			return 0;
+		t += days_from_civil(y, mo, d) * 86400000000000LL;
+		t -= parse_zone(&s);
+		*tp = t;
+		return timestamp_ends(s);
+	}
+
+	/* Time of day */
+	s = get_word(i) + (*get_word(i) == '[');
+	if (parse_time_of_day(&s, &t)) {
+		*tp = t;
+		return timestamp_ends(s);
+	}
+
+	/* syslog */
+	if (isalpha(s[0]) && isalpha(s[1]) && isalpha(s[2]) && !s[3] && i + 2 < end) {
+		for (mo = 0; mo < 12; mo++)
+			if (tolower(s[0]) == months[mo * 3] && tolower(s[1]) == months[mo * 3 + 1] &&
+			    tolower(s[2]) == months[mo * 3 + 2])
+				break;
+		s = get_word(++i);
+		if (mo == 12 || !isdigit(*s) || (s[1] && (!isdigit(s[1]) || s[2])))
+			return 0;
+		d = strtol(s, NULL, 10);
+		s = get_word(++i);
+		if (!parse_time_of_day(&s, &t))
+			return 0;
+		*tp = t + days_from_civil(2000, mo + 1, d) * 86400000000000LL;
+		return timestamp_ends(s);
+	}
+
+	/* Unix time */
+	for (p = s; isdigit(*p); p++);
+	n = (size_t)(p - s);
+	if ((n != 10 && n != 13 && n != 16 && n != 19) || (n == 19 && *s == '9'))
+		return 0;
+	for (t = 0; s != p; s++)
+		t = t * 10 + (*s - '0');
+	for (k = n; k < 19; k += 3)
+		t *= 1000;
+	if (n == 10 && *s == '.' && isdigit(s[1]))
+		for (scale = 1000000000LL, s++; isdigit(*s); s++)
+			if ((scale /= 10))
+				t += (*s - '0') * scale;
+	*tp = t;
+	return timestamp_ends(s);
+}
+
+
+/**
+ * Parse the timestamps at the beginning of the lines,
+ * so that lines can be paced by `pacer_line`.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+int
+load_timestamps(void)
+{
+	size_t i, end, capacity = 0;
+	long long t;
+	void *new;
+
+	free_timestamps();
+	for (i = 0; i < word_count; i = end) {
+		for (end = i + 1; end < word_count && !(word_flags[end] & WORD_LINE_START); end++);
+		if (!parse_timestamp(i, end, &t))
+			continue;
+		if (time_count == capacity) {
+			capacity = capacity ? capacity << 1 : 64;
+			new = realloc(times, capacity * sizeof(*times));
+			if (!new)
+				goto fail;
+			times = new;
+		}
+		times[time_count].word = i;
+		times[time_count++].t = t;
+	}
+	return 0;
+
+fail:
+	free_timestamps();
+	return -1;
+}
+
+
+/**
+ * Deallocate the timestamps of the lines.
+ */
+void
+free_timestamps(void)
+{
+	free(times);
+	times = NULL;
+	time_count = 0;
+}
+
+
+/**
+ * Get the timestamp of a line.
+ * 
+ * @param   i   The index of a word.
+ * @param   tp  Output parameter for the time, in nanoseconds
+ *              since an arbitrary point in time.
+ * @return      1 if the word is the first word of a
+ *              line with a timestamp, 0 otherwise.
+ */
+int
+line_timestamp(size_t i, long long *tp)
+{
+	size_t lo = 0, hi = time_count, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (times[mid].word < i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == time_count || times[lo].word != i)
+		return 0;
+	*tp = times[lo].t;
+	return 1;
+}
@@ -0,0 +1,240 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * A client attached to the server.
+ */
+struct client {
+	/**
+	 * The socket connected to the client.
+	 */
+	int fd;
+
+	/**
+	 * The word that was last queued for the client,
+	 * `SIZE_MAX` if none.
+	 */
+	size_t word;
+
+	/**
+	 * The record being sent to the client.
+	 */
+	char *buf;
+
+	/**
+	 * The allocation size of `buf`.
+	 */
+	size_t size;
+
+	/**
+	 * The length of the record in `buf`.
+	 */
+	size_t len;
+
+	/**
+	 * The number of bytes in `buf` that have been sent.
+	 */
+	size_t ptr;
+};
+
+
+
+static void release_client(void *c);
+
+
+
+/**
+ * The attached clients.
+ */
+static struct client clients[MAX_CLIENTS];
+
+/**
+ * The listening socket, and the attached clients.
+ */
+static struct listener server = {
+	.fd = -1,
+	.connections = clients,
+	.connection_size = sizeof(*clients),
+	.max_connections = MAX_CLIENTS,
+	.release = release_client
+};
+
+/**
+ * The word currently being displayed,
+ * `SIZE_MAX` if none yet.
+ */
+static size_t current_word = SIZE_MAX;
+
+
+
+/**
+ * Start serving words to clients.
+ * 
+ * @param   path  The pathname of the socket to create.
+ * @return        0 on success, -1 on error.
+ */
+int
+start_server(const char *path)
+{
+	return start_listener(&server, path);
+}
+
+
+/**
+ * Free the resources of a client that is disconnected.
+ * 
+ * @param  c  The client.
+ */
+static void
+release_client(void *c)
+{
+	free(((struct client *)c)->buf);
+}
+
+
+/**
+ * Stop serving words, and disconnect all clients.
+ */
+void
+stop_server(void)
+{
+	stop_listener(&server);
+}
+
+
+/**
+ * Send as much as possible to a client without blocking.
+ * If the client is still receiving an old word when
+ * a new word is displayed, the old word is finished
+ * and then the newest word is sent, skipping any
+ * words in between, so a slow client cannot hold
+ * back the other clients.
+ * 
+ * @param   c  The client.
+ * @return     0 on success, -1 if the client shall be dropped.
+ */
+static int
+flush_client(struct client *c)
+{
+	const char *word;
+	size_t size;
+	ssize_t n;
+	void *new;
+	int r;
+
+	for (;;) {
+		while (c->ptr < c->len) {
+			n = send(c->fd, &c->buf[c->ptr], c->len - c->ptr, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				return -1;
+			}
+			c->ptr += (size_t)n;
+		}
+		if (current_word == SIZE_MAX || c->word == current_word)
+			return 0;
+
+		word = get_word(current_word);
+		size = strlen(word) + 32;
+		if (size > c->size) {
+			new = realloc(c->buf, size);
+			if (!new)
+				return -1;
+			c->buf = new;
+			c->size = size;
+		}
+		r = snprintf(c->buf, c->size, "%u %u %s\n",
+		             (unsigned)word_flags[current_word],
+		             (unsigned)word_anchors[current_word], word);
+		if (r < 0)
+			return -1;
+		c->len = (size_t)r;
+		c->ptr = 0;
+		c->word = current_word;
+	}
+}
+
+
+/**
+ * Send a word to all clients.
+ * 
+ * @param  i  The index of the word.
+ */
+void
+broadcast_word(size_t i)
+{
+	size_t j;
+	current_word = i;
+	for (j = server.count; j--;)
+		if (flush_client(&clients[j]))
+			drop_connection(&server, j);
+}
+
+
+/**
+ * Add the file descriptors the server
+ * waits for to a set of file descriptors to poll.
+ * 
+ * @param   fds  Output parameter for the file descriptors,
+ *               must have room for `MAX_CLIENTS + 1` elements.
+ * @return       The number of added file descriptors.
+ */
+size_t
+server_poll_fds(struct pollfd *fds)
+{
+	size_t i, n = listener_poll_fds(&server, fds);
+	for (i = 1; i < n; i++)
+		if (clients[i - 1].ptr < clients[i - 1].len)
+			fds[i].events |= POLLOUT;
+	return n;
+}
+
+
+/**
+ * Handle the events on the file descriptors
+ * added by `server_poll_fds`.
+ * 
+ * @param  fds  The polled file descriptors, as
+ *              added by `server_poll_fds`.
+ * @param  n    The return value of `server_poll_fds`.
+ */
+void
+server_handle_fds(const struct pollfd *fds, size_t n)
+{
+	char buf[64];
+	size_t i, first;
+	ssize_t r;
+
+	if (!n)
+		return;
+
+	/* The clients are not expected to send anything, so any
+	 * input is discarded, and if the client has closed the
+	 * connection, it is dropped. */
+	for (i = n - 1; i; i--) {
+		if (!fds[i].revents)
+			continue;
+		if (fds[i].revents & POLLIN) {
+			r = recv(clients[i - 1].fd, buf, sizeof(buf), 0);
+			if (!r || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+				drop_connection(&server, i - 1);
+				continue;
+			}
+		}
+		if (flush_client(&clients[i - 1]))
+			drop_connection(&server, i - 1);
+	}
+
+	/* Accept new clients, and send them the current word. */
+	first = accept_connections(&server, fds);
+	for (i = server.count; i-- > first;) {
+		clients[i].word = SIZE_MAX;
+		if (flush_client(&clients[i]))
+			drop_connection(&server, i);
+	}
+}
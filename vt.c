@@ -0,0 +1,673 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * The maximum number of parameters of a
+ * control sequence that are interpreted.
+ */
+#define MAX_PARAMS  16
+
+/**
+ * The distance between tab stops.
+ */
+#define TAB_WIDTH  8
+
+/**
+ * States of the parser of the output.
+ */
+enum vt_state {
+	/**
+	 * Text and C0 control characters.
+	 */
+	STATE_GROUND,
+
+	/**
+	 * After ESC.
+	 */
+	STATE_ESCAPE,
+
+	/**
+	 * In a control sequence, after CSI.
+	 */
+	STATE_CSI,
+
+	/**
+	 * In a control string, such as an OSC,
+	 * which is terminated by BEL or ST.
+	 */
+	STATE_STRING,
+
+	/**
+	 * After ESC in a control string.
+	 */
+	STATE_STRING_ESCAPE,
+
+	/**
+	 * After ESC and an intermediate byte, such as
+	 * in a character set designation, which is
+	 * followed by one final byte.
+	 */
+	STATE_FINAL
+};
+
+/**
+ * Graphic rendition attributes of a cell.
+ */
+enum vt_attribute {
+	ATTRIBUTE_BOLD      = 0x001,
+	ATTRIBUTE_FAINT     = 0x002,
+	ATTRIBUTE_ITALIC    = 0x004,
+	ATTRIBUTE_UNDERLINE = 0x008,
+	ATTRIBUTE_BLINK     = 0x010,
+	ATTRIBUTE_REVERSE   = 0x020,
+	ATTRIBUTE_CONCEAL   = 0x040,
+	ATTRIBUTE_STRIKE    = 0x080
+};
+
+
+
+/**
+ * Get the number of columns a character occupies.
+ * 
+ * The locale is not consulted, as the terminal's
+ * idea of the width is what matters, and it is
+ * approximated as East Asian wide characters and
+ * emoji occupying two columns, and combining
+ * characters none.
+ * 
+ * @param   c  The character.
+ * @return     The number of columns, 0, 1, or 2.
+ */
+static int
+char_width(uint32_t c)
+{
+	if ((c >= 0x0300 && c <= 0x036F) || (c >= 0x1AB0 && c <= 0x1AFF) ||
+	    (c >= 0x1DC0 && c <= 0x1DFF) || (c >= 0x20D0 && c <= 0x20FF) ||
+	    (c >= 0xFE20 && c <= 0xFE2F) || c == 0x200B || c == 0x200D)
+		return 0;
+	if ((c >= 0x1100 && c <= 0x115F) || (c >= 0x2E80 && c <= 0x303E) ||
+	    (c >= 0x3041 && c <= 0x33FF) || (c >= 0x3400 && c <= 0x4DBF) ||
+	    (c >= 0x4E00 && c <= 0x9FFF) || (c >= 0xA000 && c <= 0xA4CF) ||
+	    (c >= 0xAC00 && c <= 0xD7A3) || (c >= 0xF900 && c <= 0xFAFF) ||
+	    (c >= 0xFE30 && c <= 0xFE4F) || (c >= 0xFF00 && c <= 0xFF60) ||
+	    (c >= 0xFFE0 && c <= 0xFFE6) || (c >= 0x1F300 && c <= 0x1F64F) ||
+	    (c >= 0x1F900 && c <= 0x1F9FF) || (c >= 0x20000 && c <= 0x3FFFD))
+		return 2;
+	return 1;
+}
+
+
+/**
+ * Get a cell.
+ * 
+ * @param   vt   The model of the terminal.
+ * @param   row  The row of the cell.
+ * @param   col  The column of the cell.
+ * @return       The cell.
+ */
+static struct vt_cell *
+cell(struct vt *vt, size_t row, size_t col)
+{
+	return &vt->cells[row * vt->width + col];
+}
+
+
+/**
+ * Erase cells in a row. Erased cells get the current
+ * background colour, but no other attributes, as
+ * terminals with the bce capability do.
+ * 
+ * @param  vt   The model of the terminal.
+ * @param  row  The row.
+ * @param  col  The first column to erase.
+ * @param  end  The column after the last column to erase.
+ */
+static void
+erase(struct vt *vt, size_t row, size_t col, size_t end)
+{
+	struct vt_cell blank;
+	memset(&blank, 0, sizeof(blank));
+	blank.c = ' ';
+	blank.fg = -1;
+	blank.bg = vt->pen.bg;
+	for (end = end < vt->width ? end : vt->width; col < end; col++)
+		*cell(vt, row, col) = blank;
+}
+
+
+/**
+ * Move the cursor down a row, scrolling
+ * up if it is at the bottom of the screen.
+ * 
+ * @param  vt  The model of the terminal.
+ */
+static void
+line_feed(struct vt *vt)
+{
+	if (vt->row + 1 < vt->height) {
+		vt->row += 1;
+		return;
+	}
+	memmove(vt->cells, cell(vt, 1, 0), (vt->height - 1) * vt->width * sizeof(*vt->cells));
+	erase(vt, vt->row, 0, vt->width);
+}
+
+
+/**
+ * Reset the terminal, and clear the screen.
+ * 
+ * @param  vt  The model of the terminal.
+ */
+static void
+reset(struct vt *vt)
+{
+	size_t row;
+	memset(&vt->pen, 0, sizeof(vt->pen));
+	vt->pen.fg = vt->pen.bg = -1;
+	vt->row = vt->col = 0;
+	vt->wrap = 0;
+	vt->state = STATE_GROUND;
+	vt->utf8_pending = 0;
+	for (row = 0; row < vt->height; row++)
+		erase(vt, row, 0, vt->width);
+}
+
+
+/**
+ * Write a character to the screen, at the cursor.
+ * 
+ * @param  vt  The model of the terminal.
+ * @param  c   The character.
+ */
+static void
+put_char(struct vt *vt, uint32_t c)
+{
+	int w = char_width(c);
+	struct vt_cell *p;
+
+	if (!w)
+		return;
+	if (vt->wrap || (w == 2 && vt->col + 1 >= vt->width && vt->width > 1)) {
+		vt->col = 0;
+		line_feed(vt);
+	}
+	vt->wrap = 0;
+
+	/* Do not leave half of a wide character. */
+	p = cell(vt, vt->row, vt->col);
+	if (!p->c && vt->col)
+		p[-1].c = ' ';
+	if (vt->col + (size_t)w < vt->width && !p[w].c)
+		p[w].c = ' ';
+
+	*p = vt->pen;
+	p->c = c;
+	if (w == 2 && vt->col + 1 < vt->width) {
+		p[1] = vt->pen;
+		p[1].c = 0;
+	}
+
+	vt->col += (size_t)w;
+	if (vt->col >= vt->width) {
+		vt->col = vt->width - 1;
+		vt->wrap = 1;
+	}
+}
+
+
+/**
+ * Execute a C0 control character.
+ * 
+ * @param  vt  The model of the terminal.
+ * @param  c   The control character.
+ */
+static void
+execute(struct vt *vt, unsigned char c)
+{
+	switch (c) {
+	case '\b':
+		vt->col -= vt->col > 0;
+		break;
+	case '\t':
+		vt->col = (vt->col / TAB_WIDTH + 1) * TAB_WIDTH;
+		vt->col = vt->col < vt->width ? vt->col : vt->width - 1;
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		line_feed(vt);
+		break;
+	case '\r':
+		vt->col = 0;
+		break;
+	case '\a':
+	default:
+		return;
+	}
+	vt->wrap = 0;
+	vt->controls += 1;
+}
+
+
+/**
+ * Apply an extended colour parameter of SGR,
+ * 38 or 48, in either of the forms 5;n and 2;r;g;b.
+ * 
+ * @param   colourp  The colour to set.
+ * @param   params   The parameters after the 38 or 48.
+ * @param   n        The number of elements in `params`.
+ * @return           The number of parameters consumed.
+ */
+static size_t
+set_extended_colour(int32_t *colourp, const long *params, size_t n)
+{
+	if (n >= 2 && params[0] == 5) {
+		*colourp = (int32_t)(params[1] & 0xFF);
+		return 2;
+	}
+	if (n >= 4 && params[0] == 2) {
+		*colourp = (int32_t)(0x1000000 | (params[1] & 0xFF) << 16 | (params[2] & 0xFF) << 8 | (params[3] & 0xFF));
+		return 4;
+	}
+	return n;
+}
+
+
+/**
+ * Select graphic rendition.
+ * 
+ * @param  vt      The model of the terminal.
+ * @param  params  The parameters, -1 for omitted parameters.
+ * @param  n       The number of elements in `params`.
+ */
+static void
+select_rendition(struct vt *vt, const long *params, size_t n)
+{
+	static const uint32_t on[10] = {
+		0, ATTRIBUTE_BOLD, ATTRIBUTE_FAINT, ATTRIBUTE_ITALIC, ATTRIBUTE_UNDERLINE,
+		ATTRIBUTE_BLINK, ATTRIBUTE_BLINK, ATTRIBUTE_REVERSE, ATTRIBUTE_CONCEAL, ATTRIBUTE_STRIKE
+	};
+	static const uint32_t off[10] = {
+		0, 0, ATTRIBUTE_BOLD | ATTRIBUTE_FAINT, ATTRIBUTE_ITALIC, ATTRIBUTE_UNDERLINE,
+		ATTRIBUTE_BLINK, 0, ATTRIBUTE_REVERSE, ATTRIBUTE_CONCEAL, ATTRIBUTE_STRIKE
+	};
+	size_t i;
+	long p;
+
+	if (!n) {
+		vt->pen.attributes = 0;
+		vt->pen.fg = vt->pen.bg = -1;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		p = params[i] < 0 ? 0 : params[i];
+		if (p == 0) {
+			vt->pen.attributes = 0;
+			vt->pen.fg = vt->pen.bg = -1;
+		} else if (p < 10) {
+			vt->pen.attributes |= on[p];
+		} else if (p == 21) {
+			vt->pen.attributes |= ATTRIBUTE_UNDERLINE;
+		} else if (p >= 22 && p <= 29) {
+			vt->pen.attributes &= ~off[p - 20];
+		} else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97)) {
+			vt->pen.fg = (int32_t)(p >= 90 ? p - 90 + 8 : p - 30);
+		} else if ((p >= 40 && p <= 47) || (p >= 100 && p <= 107)) {
+			vt->pen.bg = (int32_t)(p >= 100 ? p - 100 + 8 : p - 40);
+		} else if (p == 38 || p == 48) {
+			i += set_extended_colour(p == 38 ? &vt->pen.fg : &vt->pen.bg, &params[i + 1], n - i - 1);
+		} else if (p == 39) {
+			vt->pen.fg = -1;
+		} else if (p == 49) {
+			vt->pen.bg = -1;
+		}
+	}
+}
+
+
+/**
+ * Execute a control sequence.
+ * 
+ * @param  vt     The model of the terminal.
+ * @param  final  The final byte of the control sequence.
+ */
+static void
+dispatch_csi(struct vt *vt, char final)
+{
+	long params[MAX_PARAMS];
+	size_t n = 0, row, a;
+	const char *s = vt->params;
+	int private = 0;
+
+	vt->controls += 1;
+
+	/* Parse the parameters, -1 for omitted parameters. */
+	if (*s >= '<' && *s <= '?')
+		private = *s++;
+	if (*s) {
+		params[n++] = -1;
+		for (; *s; s++) {
+			if (isdigit(*s)) {
+				params[n - 1] = (params[n - 1] < 0 ? 0 : params[n - 1]) * 10 + (*s - '0');
+				if (params[n - 1] > 0xFFFF)
+					params[n - 1] = 0xFFFF;
+			} else if ((*s == ';' || *s == ':') && n < MAX_PARAMS) {
+				params[n++] = -1;
+			} else if (*s < '0' || *s > '?') {
+				/* Intermediate bytes */
+				private = private ? private : *s;
+			}
+		}
+	}
+	a = n && params[0] > 0 ? (size_t)params[0] : 1;
+
+	if (private) {
+		/* Modes, and queries; none changes the screen. */
+		if (final != 'h' && final != 'l' && final != 'n' && final != 'c')
+			vt->unsupported += 1;
+		return;
+	}
+
+	switch (final) {
+	case 'A':
+	case 'F':
+		vt->row = vt->row > a ? vt->row - a : 0;
+		if (final == 'F')
+			vt->col = 0;
+		break;
+	case 'B':
+	case 'E':
+	case 'e':
+		vt->row = vt->row + a < vt->height ? vt->row + a : vt->height - 1;
+		if (final == 'E')
+			vt->col = 0;
+		break;
+	case 'C':
+	case 'a':
+		vt->col = vt->col + a < vt->width ? vt->col + a : vt->width - 1;
+		break;
+	case 'D':
+		vt->col = vt->col > a ? vt->col - a : 0;
+		break;
+	case 'G':
+	case '`':
+		vt->col = a <= vt->width ? a - 1 : vt->width - 1;
+		break;
+	case 'd':
+		vt->row = a <= vt->height ? a - 1 : vt->height - 1;
+		break;
+	case 'H':
+	case 'f':
+		vt->row = a <= vt->height ? a - 1 : vt->height - 1;
+		a = n > 1 && params[1] > 0 ? (size_t)params[1] : 1;
+		vt->col = a <= vt->width ? a - 1 : vt->width - 1;
+		break;
+	case 'J':
+		a = n && params[0] > 0 ? (size_t)params[0] : 0;
+		if (a == 0) {
+			erase(vt, vt->row, vt->col, vt->width);
+			for (row = vt->row + 1; row < vt->height; row++)
+				erase(vt, row, 0, vt->width);
+		} else if (a == 1) {
+			for (row = 0; row < vt->row; row++)
+				erase(vt, row, 0, vt->width);
+			erase(vt, vt->row, 0, vt->col + 1);
+		} else {
+			for (row = 0; row < vt->height; row++)
+				erase(vt, row, 0, vt->width);
+		}
+		return;
+	case 'K':
+		a = n && params[0] > 0 ? (size_t)params[0] : 0;
+		if (a == 0)
+			erase(vt, vt->row, vt->col, vt->width);
+		else if (a == 1)
+			erase(vt, vt->row, 0, vt->col + 1);
+		else
+			erase(vt, vt->row, 0, vt->width);
+		return;
+	case 'X':
+		erase(vt, vt->row, vt->col, vt->col + a);
+		return;
+	case 'm':
+		select_rendition(vt, params, n);
+		return;
+	case 'n':
+	case 'c':
+	case 't':
+		/* Queries and window operations. */
+		return;
+	default:
+		vt->unsupported += 1;
+		return;
+	}
+	vt->wrap = 0;
+}
+
+
+/**
+ * Execute an escape sequence, that is not a control sequence.
+ * 
+ * @param  vt     The model of the terminal.
+ * @param  final  The byte after ESC.
+ */
+static void
+dispatch_escape(struct vt *vt, char final)
+{
+	vt->controls += 1;
+	switch (final) {
+	case 'c':
+		reset(vt);
+		break;
+	case 'D':
+		line_feed(vt);
+		vt->wrap = 0;
+		break;
+	case 'E':
+		line_feed(vt);
+		vt->col = 0;
+		vt->wrap = 0;
+		break;
+	case 'M':
+		vt->row -= vt->row > 0;
+		vt->wrap = 0;
+		break;
+	case '=':
+	case '>':
+	case '\\':
+		break;
+	default:
+		vt->unsupported += 1;
+		break;
+	}
+}
+
+
+/**
+ * Interpret a byte that is not part of a UTF-8 sequence.
+ * 
+ * @param  vt  The model of the terminal.
+ * @param  c   The byte.
+ */
+static void
+feed_byte(struct vt *vt, unsigned char c)
+{
+	switch (vt->state) {
+	case STATE_GROUND:
+		if (c == '\033')
+			vt->state = STATE_ESCAPE;
+		else if (c < ' ')
+			execute(vt, c);
+		else if (c < 0x7F)
+			put_char(vt, c);
+		break;
+
+	case STATE_ESCAPE:
+		if (c == '[') {
+			vt->state = STATE_CSI;
+			vt->param_len = 0;
+			vt->params[0] = '\0';
+		} else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+			vt->state = STATE_STRING;
+		} else if (c >= ' ' && c <= '/') {
+			vt->state = STATE_FINAL;
+		} else if (c == '\033') {
+			vt->state = STATE_ESCAPE;
+		} else if (c < ' ') {
+			execute(vt, c);
+		} else {
+			vt->state = STATE_GROUND;
+			dispatch_escape(vt, (char)c);
+		}
+		break;
+
+	case STATE_CSI:
+		if (c == '\033') {
+			vt->state = STATE_ESCAPE;
+		} else if (c == 0x18 || c == 0x1A) {
+			vt->state = STATE_GROUND;
+		} else if (c < ' ') {
+			execute(vt, c);
+		} else if (c < '@') {
+			if (vt->param_len + 1 < sizeof(vt->params)) {
+				vt->params[vt->param_len++] = (char)c;
+				vt->params[vt->param_len] = '\0';
+			}
+		} else {
+			vt->state = STATE_GROUND;
+			dispatch_csi(vt, (char)c);
+		}
+		break;
+
+	case STATE_STRING:
+		if (c == '\a') {
+			vt->state = STATE_GROUND;
+			vt->controls += 1;
+		} else if (c == '\033') {
+			vt->state = STATE_STRING_ESCAPE;
+		}
+		break;
+
+	case STATE_STRING_ESCAPE:
+		vt->state = c == '\\' ? STATE_GROUND : STATE_STRING;
+		vt->controls += c == '\\';
+		break;
+
+	case STATE_FINAL:
+	default:
+		if (c >= ' ' && c <= '/')
+			break;
+		vt->state = STATE_GROUND;
+		vt->controls += 1;
+		break;
+	}
+}
+
+
+/**
+ * Create a model of a terminal, with a blank screen,
+ * to write output to, see what the screen would show,
+ * and count the bytes and the control functions.
+ * 
+ * @param   vt      The model to initialise.
+ * @param   width   The width of the screen.
+ * @param   height  The height of the screen.
+ * @return          0 on success, -1 on error.
+ */
+int
+vt_init(struct vt *vt, size_t width, size_t height)
+{
+	memset(vt, 0, sizeof(*vt));
+	vt->width = width ? width : 1;
+	vt->height = height ? height : 1;
+	if (vt->width > SIZE_MAX / sizeof(*vt->cells) / vt->height)
+		return errno = ENOMEM, -1;
+	vt->cells = malloc(vt->width * vt->height * sizeof(*vt->cells));
+	if (!vt->cells)
+		return -1;
+	reset(vt);
+	return 0;
+}
+
+
+/**
+ * Deallocate a model of a terminal.
+ * 
+ * @param  vt  The model.
+ */
+void
+vt_destroy(struct vt *vt)
+{
+	free(vt->cells);
+	vt->cells = NULL;
+}
+
+
+/**
+ * Write output to a model of a terminal, which is
+ * interpreted as UTF-8 text, and ECMA-48 control
+ * functions, as a VT100 compatible terminal with
+ * automatic margins would.
+ * 
+ * @param  vt  The model.
+ * @param  s   The output.
+ * @param  n   The number of bytes in `s`.
+ */
+void
+vt_write(struct vt *vt, const char *s, size_t n)
+{
+	unsigned char c;
+
+	vt->bytes += n;
+	for (; n--; s++) {
+		c = (unsigned char)*s;
+		if (vt->utf8_pending) {
+			if ((c & 0xC0) == 0x80) {
+				vt->utf8 = vt->utf8 << 6 | (c & 0x3F);
+				if (!--vt->utf8_pending && vt->state == STATE_GROUND)
+					put_char(vt, vt->utf8);
+				continue;
+			}
+			vt->utf8_pending = 0;
+			if (vt->state == STATE_GROUND)
+				put_char(vt, 0xFFFD);
+		}
+		if (c < 0x80) {
+			feed_byte(vt, c);
+		} else if (c >= 0xC2 && c <= 0xF4) {
+			vt->utf8_pending = c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+			vt->utf8 = c & (0x3F >> vt->utf8_pending);
+		} else if (vt->state == STATE_GROUND) {
+			put_char(vt, 0xFFFD);
+		}
+	}
+}
+
+
+/**
+ * Compare what the screens of two models of
+ * terminals, of the same size, show.
+ * 
+ * @param   a     One of the models.
+ * @param   b     The other model.
+ * @param   rowp  Output parameter for the row of the first
+ *                cell that differs, if the screens differ.
+ * @param   colp  Output parameter for the column of the first
+ *                cell that differs, if the screens differ.
+ * @return        1 if the screens differ, 0 otherwise.
+ */
+int
+vt_differs(const struct vt *a, const struct vt *b, size_t *rowp, size_t *colp)
+{
+	size_t i, n = a->width * a->height;
+	if (!memcmp(a->cells, b->cells, n * sizeof(*a->cells)))
+		return 0;
+	for (i = 0; i < n; i++)
+		if (memcmp(&a->cells[i], &b->cells[i], sizeof(*a->cells)))
+			break;
+	*rowp = i / a->width;
+	*colp = i % a->width;
+	return 1;
+}
@@ -0,0 +1,226 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+
+/**
+ * A state in the keyword automaton.
+ */
+struct watch_state {
+	/**
+	 * The state to go to for each byte.
+	 */
+	uint32_t next[256];
+
+	/**
+	 * The state to fall back to when the
+	 * automaton is being built.
+	 */
+	uint32_t fail;
+
+	/**
+	 * Does a keyword end in this state?
+	 */
+	int match;
+};
+
+
+
+/**
+ * The states of the keyword automaton, the first
+ * state is the initial state, `NULL` if there is
+ * no watchlist.
+ */
+static struct watch_state *states = NULL;
+
+/**
+ * The number of elements in `states`.
+ */
+static size_t state_count = 0;
+
+/**
+ * The allocation size of `states`.
+ */
+static size_t state_capacity = 0;
+
+
+
+/**
+ * Create a state in the keyword automaton.
+ * 
+ * @return  The index of the state, 0 on error.
+ */
+static uint32_t
+new_state(void)
+{
+	void *new;
+	if (state_count == state_capacity) {
+		if (state_count == UINT32_MAX)
+			return errno = ENOMEM, 0;
+		state_capacity = state_capacity ? state_capacity << 1 : 64;
+		new = realloc(states, state_capacity * sizeof(*states));
+		if (!new)
+			return 0;
+		states = new;
+	}
+	memset(&states[state_count], 0, sizeof(*states));
+	return (uint32_t)state_count++;
+}
+
+
+/**
+ * Add a keyword to the keyword automaton.
+ * 
+ * @param   s  The keyword.
+ * @param   n  The length of `s`.
+ * @return     0 on success, -1 on error.
+ */
+static int
+add_keyword(const char *s, size_t n)
+{
+	uint32_t state = 0, next;
+	unsigned char c;
+	for (; n--; s++) {
+		c = (unsigned char)tolower((unsigned char)*s);
+		if (!(next = states[state].next[c])) {
+			if (!(next = new_state()))
+				return -1;
+			states[state].next[c] = next;
+		}
+		state = next;
+	}
+	states[state].match = 1;
+	return 0;
+}
+
+
+/**
+ * Complete the keyword automaton, so that it has
+ * a transition from every state for every byte.
+ * 
+ * The states are visited breadth-first, and every
+ * missing transition is taken from the state that
+ * the state falls back to, which is the state for
+ * the longest proper suffix of the state's string.
+ * 
+ * @return  0 on success, -1 on error.
+ */
+static int
+complete_automaton(void)
+{
+	uint32_t *queue, state, next;
+	size_t head = 0, tail = 0;
+	int c;
+
+	queue = malloc(state_count * sizeof(*queue));
+	if (!queue)
+		return -1;
+
+	for (c = 0; c < 256; c++)
+		if ((next = states[0].next[c]))
+			queue[tail++] = next;
+
+	while (head < tail) {
+		state = queue[head++];
+		states[state].match |= states[states[state].fail].match;
+		for (c = 0; c < 256; c++) {
+			next = states[state].next[c];
+			if (next) {
+				states[next].fail = states[states[state].fail].next[c];
+				queue[tail++] = next;
+			} else {
+				states[state].next[c] = states[states[state].fail].next[c];
+			}
+		}
+	}
+
+	free(queue);
+	return 0;
+}
+
+
+/**
+ * Load a watchlist, a file with one keyword per line.
+ * Words that contain any of the keywords, ignoring
+ * case, will be marked by `mark_watched_words`.
+ * 
+ * @param   path  The pathname of the file.
+ * @return        0 on success, -1 on error.
+ */
+int
+load_watchlist(const char *path)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t n;
+	FILE *f;
+	int saved_errno;
+
+	free_watchlist();
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	new_state();
+	if (!state_count)
+		goto fail;
+
+	while ((n = getline(&line, &size, f)) >= 0) {
+		if (n && line[n - 1] == '\n')
+			n--;
+		if (n && line[n - 1] == '\r')
+			n--;
+		if (n && add_keyword(line, (size_t)n))
+			goto fail;
+	}
+	if (ferror(f))
+		goto fail;
+	if (complete_automaton())
+		goto fail;
+
+	free(line);
+	fclose(f);
+	return 0;
+
+fail:
+	saved_errno = errno;
+	free(line);
+	fclose(f);
+	free_watchlist();
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Deallocate the watchlist.
+ */
+void
+free_watchlist(void)
+{
+	free(states);
+	states = NULL;
+	state_count = state_capacity = 0;
+}
+
+
+/**
+ * Annotator that marks the words that
+ * contain a keyword in the watchlist.
+ * 
+ * @param  first  The index of the first word to annotate.
+ * @param  end    The index of the word after the last word to annotate.
+ */
+void
+mark_watched_words(size_t first, size_t end)
+{
+	const unsigned char *s;
+	uint32_t state;
+	size_t i;
+	for (i = first; i < end; i++) {
+		state = 0;
+		for (s = (const unsigned char *)get_word(i); *s && !states[state].match; s++)
+			state = states[state].next[tolower(*s)];
+		if (states[state].match)
+			word_flags[i] |= WORD_WATCHED;
+	}
+}